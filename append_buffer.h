@@ -0,0 +1,73 @@
+//
+// AppendBuffer: growable storage for a version that is still being appended to.
+//
+// INSERT on an unsnapshotted version appends in place. Re-interning the whole
+// grown string into the BlobStore on every INSERT would copy and hash it each
+// time (quadratic in the number of appends), so such a version keeps its bytes
+// in an AppendBuffer instead, with spare capacity that grows geometrically, and
+// is interned once when it is snapshotted or left.
+//
+// Appending only writes past the current end and never moves bytes, so a
+// reader holding a view of the first size() bytes (and a reference to the
+// buffer) keeps seeing them unchanged while the writer goes on appending. When
+// the capacity runs out the writer moves to a new, larger buffer; old readers
+// keep the old one alive until they are done.
+//
+// allocated_bytes() is the capacity of all live buffers, spare room included
+// (counted against --memory-budget).
+//
+
+#ifndef APPEND_BUFFER_H
+#define APPEND_BUFFER_H
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+class AppendBuffer
+{
+    private:
+        static constexpr size_t MIN_CAPACITY = 256;
+
+        inline static std::atomic<size_t> allocated{0};
+
+        std::unique_ptr<char[]> bytes;
+        size_t cap;
+        size_t len = 0;
+
+    public:
+        // An empty buffer with room for at least capacity bytes
+        explicit AppendBuffer(size_t capacity) : cap(capacity < MIN_CAPACITY ? MIN_CAPACITY : capacity) {
+            bytes.reset(new char[cap]);
+            allocated.fetch_add(cap, std::memory_order_relaxed);
+        }
+        AppendBuffer(const AppendBuffer &) = delete;
+        AppendBuffer &operator=(const AppendBuffer &) = delete;
+        ~AppendBuffer(){ allocated.fetch_sub(cap, std::memory_order_relaxed); }
+
+        // Capacity of every AppendBuffer alive in the process
+        static size_t allocated_bytes(){ return allocated.load(std::memory_order_relaxed); }
+
+        // A buffer holding prefix + s, with room to double
+        static std::shared_ptr<AppendBuffer> grown(std::string_view prefix, std::string_view s){
+            auto b = std::make_shared<AppendBuffer>(2 * (prefix.size() + s.size()));
+            b->append(prefix);
+            b->append(s);
+            return b;
+        }
+
+        size_t size() const { return len; }
+        size_t capacity() const { return cap; }
+        std::string_view view() const { return std::string_view(bytes.get(), len); }
+
+        // Append s if it fits in the spare capacity; false (and nothing appended) if not
+        bool append(std::string_view s){
+            if(s.size() > cap - len) return false;
+            if(!s.empty()) std::memcpy(bytes.get() + len, s.data(), s.size());
+            len += s.size();
+            return true;
+        }
+};
+
+#endif // APPEND_BUFFER_H
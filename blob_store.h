@@ -0,0 +1,177 @@
+//
+// BlobStore: content-addressed, deduplicated storage of immutable byte strings.
+//
+// Every distinct byte string is stored once as a refcounted Blob, identified by
+// a hash of its bytes. Interning the same bytes again (from any version of any
+// file) returns a new reference to the existing Blob; the Blob is freed when
+// its last BlobRef goes away.
+//
+// Hash modes:
+//   FAST   - 64-bit fast_hash64 of the bytes; equal hashes are confirmed by
+//            comparing the bytes, so collisions are harmless.
+//   SHA1   - Git object id: SHA-1 of "blob <len>\0" + bytes.
+//   SHA256 - Same, for Git's SHA-256 object format.
+// The mode must be chosen before the first blob is interned.
+//
+// Thread safety: intern() and the final release of a blob take the store's
+// mutex (ids are computed before it is taken); other reference count changes
+// are atomic, so BlobRefs can be copied and dropped from any thread.
+//
+
+#ifndef BLOB_STORE_H
+#define BLOB_STORE_H
+
+#include <cstdint>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "fast_hash.h"
+#include "sha_hash.h"
+
+enum class HashMode { FAST, SHA1, SHA256 };
+
+class BlobStore;
+
+// An immutable, refcounted byte string owned by a BlobStore
+struct Blob
+{
+    std::string bytes;
+    unsigned char id[32]; // Object id (8, 20 or 32 bytes depending on the hash mode)
+    uint8_t id_len;
+    uint64_t key;         // First 8 bytes of id; the store's hash table key
+    std::atomic<uint32_t> refs;
+    Blob* next;           // Next blob with the same key
+    BlobStore* owner;
+
+    // Object id as lowercase hex
+    std::string id_hex() const {
+        static const char* digits = "0123456789abcdef";
+        std::string s;
+        for(int i = 0; i < id_len; ++i){ s += digits[id[i] >> 4]; s += digits[id[i] & 15]; }
+        return s;
+    }
+};
+
+// Owning handle to a Blob (like a shared_ptr); an empty BlobRef reads as ""
+class BlobRef
+{
+    private:
+        Blob* b = nullptr;
+
+    public:
+        BlobRef() {}
+        explicit BlobRef(Blob* blob) : b(blob) { if(b) b->refs.fetch_add(1, std::memory_order_relaxed); }
+        BlobRef(const BlobRef &o) : b(o.b) { if(b) b->refs.fetch_add(1, std::memory_order_relaxed); }
+        BlobRef(BlobRef &&o) noexcept : b(o.b) { o.b = nullptr; }
+        BlobRef &operator=(BlobRef o) noexcept { std::swap(b, o.b); return *this; }
+        ~BlobRef();
+
+        const Blob* get() const { return b; }
+        std::string_view view() const { return b ? std::string_view(b->bytes) : std::string_view(); }
+        size_t size() const { return b ? b->bytes.size() : 0; }
+};
+
+class BlobStore
+{
+    private:
+        HashMode mode;
+        mutable std::mutex m; // Protects table, the counters and every 1 -> 0 reference count transition
+        std::unordered_map<uint64_t, Blob*> table;
+        size_t blob_count = 0;
+        size_t stored_bytes = 0;
+
+        template <typename Sha>
+        static void git_id(std::string_view bytes, unsigned char* out){
+            std::string header = "blob " + std::to_string(bytes.size());
+            Sha h;
+            h.update(header.data(), header.size() + 1); // Include the terminating NUL
+            h.update(bytes.data(), bytes.size());
+            h.final(out);
+        }
+
+        void compute_id(std::string_view bytes, Blob &b) const {
+            if(mode == HashMode::SHA1){ git_id<Sha1>(bytes, b.id); b.id_len = Sha1::DIGEST_SIZE; }
+            else if(mode == HashMode::SHA256){ git_id<Sha256>(bytes, b.id); b.id_len = Sha256::DIGEST_SIZE; }
+            else {
+                uint64_t h = fast_hash64(bytes);
+                std::memcpy(b.id, &h, 8);
+                b.id_len = 8;
+            }
+            std::memcpy(&b.key, b.id, 8);
+        }
+
+        bool same(const Blob &a, const Blob &b, std::string_view bytes) const {
+            if(a.id_len != b.id_len || std::memcmp(a.id, b.id, a.id_len) != 0) return false;
+            // A 64-bit fast hash can collide; cryptographic ids are trusted as-is
+            return mode != HashMode::FAST || a.bytes == bytes;
+        }
+
+    public:
+        explicit BlobStore(HashMode m = HashMode::FAST) : mode(m) {}
+        BlobStore(const BlobStore &) = delete;
+        BlobStore &operator=(const BlobStore &) = delete;
+
+        HashMode hash_mode() const { return mode; }
+        void set_hash_mode(HashMode m){
+            if(blob_count != 0) throw std::logic_error("Hash mode cannot change once blobs are stored");
+            mode = m;
+        }
+
+        // Number of distinct blobs and their total size in bytes
+        size_t count() const { std::lock_guard<std::mutex> lk(m); return blob_count; }
+        size_t bytes() const { std::lock_guard<std::mutex> lk(m); return stored_bytes; }
+
+        // Return a reference to the blob holding exactly these bytes, storing them if new
+        BlobRef intern(std::string_view bytes){
+            Blob probe;
+            compute_id(bytes, probe);
+            std::lock_guard<std::mutex> lk(m);
+            Blob* &head = table[probe.key];
+            for(Blob* b = head; b != nullptr; b = b->next){
+                if(same(*b, probe, bytes)) return BlobRef(b);
+            }
+            Blob* b = new Blob;
+            std::memcpy(b->id, probe.id, sizeof(b->id));
+            b->id_len = probe.id_len;
+            b->key = probe.key;
+            b->bytes.assign(bytes.data(), bytes.size());
+            b->refs = 0;
+            b->next = head;
+            b->owner = this;
+            head = b;
+            ++blob_count;
+            stored_bytes += b->bytes.size();
+            return BlobRef(b);
+        }
+
+        // Drop a reference whose count may reach zero; frees b if it does
+        void release(Blob* b){
+            std::lock_guard<std::mutex> lk(m);
+            if(b->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+            auto it = table.find(b->key);
+            Blob** link = &it->second;
+            while(*link != b) link = &(*link)->next;
+            *link = b->next;
+            if(it->second == nullptr) table.erase(it);
+            --blob_count;
+            stored_bytes -= b->bytes.size();
+            delete b;
+        }
+};
+
+inline BlobRef::~BlobRef(){
+    if(b == nullptr) return;
+    // Fast path while other references remain; the last one is dropped under the store's
+    // mutex so that intern() never hands out a blob that is being freed
+    uint32_t r = b->refs.load(std::memory_order_relaxed);
+    while(r > 1){
+        if(b->refs.compare_exchange_weak(r, r - 1, std::memory_order_acq_rel)) return;
+    }
+    b->owner->release(b);
+}
+
+#endif // BLOB_STORE_H
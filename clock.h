@@ -0,0 +1,65 @@
+//
+// Clock for version metadata: nanosecond timestamps that never go backwards.
+//
+// A Timestamp counts nanoseconds since the Unix epoch. clock_now() reads the
+// monotonic clock (served from the vDSO on Linux, so no system call) and adds
+// the offset to wall-clock time measured once at startup: timestamps track
+// wall time but are immune to the wall clock being stepped. Every value it
+// returns is also greater than any returned before in the process (a reading
+// that lags or ties becomes the previous value plus one), so timestamps are
+// unique and totally ordered even at very high mutation rates.
+// clock_observe() raises that floor past timestamps recorded elsewhere (a
+// replayed log, a loaded repository), so new ones still sort after them.
+//
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+using Timestamp = int64_t;
+
+constexpr Timestamp NS_PER_SECOND = 1000000000;
+
+namespace clock_detail {
+
+inline Timestamp steady_ns(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Wall-clock time minus monotonic time, measured once
+inline Timestamp wall_offset(){
+    static const Timestamp offset = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() - steady_ns();
+    return offset;
+}
+
+// Last timestamp handed out (or observed)
+inline std::atomic<Timestamp> last{0};
+
+} // namespace clock_detail
+
+// Current time, strictly later than every timestamp returned or observed before
+inline Timestamp clock_now(){
+    Timestamp t = clock_detail::steady_ns() + clock_detail::wall_offset();
+    Timestamp prev = clock_detail::last.load(std::memory_order_relaxed);
+    while(true){
+        Timestamp next = t > prev ? t : prev + 1;
+        if(clock_detail::last.compare_exchange_weak(prev, next, std::memory_order_relaxed)) return next;
+    }
+}
+
+// Make later clock_now() results sort after t
+inline void clock_observe(Timestamp t){
+    Timestamp prev = clock_detail::last.load(std::memory_order_relaxed);
+    while(t > prev && !clock_detail::last.compare_exchange_weak(prev, t, std::memory_order_relaxed)) {}
+}
+
+// Whole seconds of a timestamp (rounded down)
+inline int64_t timestamp_seconds(Timestamp t){
+    return t >= 0 ? t / NS_PER_SECOND : -((-t + NS_PER_SECOND - 1) / NS_PER_SECOND);
+}
+
+#endif // CLOCK_H
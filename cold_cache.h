@@ -0,0 +1,121 @@
+//
+// ColdCache: an LRU cache of decompressed cold versions.
+//
+// A version that has not been used for a while may have its stored bytes
+// compressed in the blob store (see lz_codec.h and File::compress_cold()).
+// Reading it then needs the bytes decompressed; the cache keeps the most
+// recently decompressed ones, up to a byte budget, so a reader that keeps
+// coming back to an old version (DIFF against it, a ROLLBACK to it and READs)
+// pays for decompression once. Entries are keyed by the compressed Blob and
+// hold a reference to it, so a key is never reused while its entry exists.
+// With --store, cold versions whose bytes were moved to disk (see
+// segment_store.h) are cached the same way, keyed by their segment key (never
+// reused either); both kinds share one budget.
+//
+// Thread safety: all methods may be called from any thread. Decompression
+// runs outside the lock; two threads missing on the same blob at once both
+// decompress it and the second result replaces the first.
+//
+#ifndef COLD_CACHE_H
+#define COLD_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "blob_store.h"
+#include "lz_codec.h"
+
+class ColdCache
+{
+    private:
+        struct Entry
+        {
+            uint64_t key;
+            BlobRef compressed; // Keeps a blob key alive (empty for a segment key)
+            std::shared_ptr<const std::string> bytes;
+        };
+        using Lru = std::list<Entry>; // Most recently used first
+
+        std::mutex lock;
+        Lru lru;
+        // Blob keys are the (8-aligned) Blob address, segment keys are odd: key * 2 + 1
+        std::unordered_map<uint64_t, Lru::iterator> index;
+        size_t used = 0; // Decompressed bytes held
+        size_t cap = size_t(64) << 20;
+        uint64_t hit_count = 0, miss_count = 0;
+
+        // Drop least recently used entries until the budget holds (lock held)
+        void trim(){
+            while(used > cap && !lru.empty()){
+                used -= lru.back().bytes->size();
+                index.erase(lru.back().key);
+                lru.pop_back();
+            }
+        }
+
+        // The cached bytes for key, or those load() returns for it (kept if they fit)
+        template <typename Load>
+        std::shared_ptr<const std::string> lookup(uint64_t key, const BlobRef &keep, Load load){
+            {
+                std::lock_guard<std::mutex> lk(lock);
+                auto it = index.find(key);
+                if(it != index.end()){
+                    ++hit_count;
+                    lru.splice(lru.begin(), lru, it->second);
+                    return it->second->bytes;
+                }
+                ++miss_count;
+            }
+            auto bytes = std::make_shared<const std::string>(load());
+            if(bytes->size() > cap) return bytes; // Too big to keep
+            std::lock_guard<std::mutex> lk(lock);
+            auto it = index.find(key);
+            if(it != index.end()){
+                used -= it->second->bytes->size();
+                lru.erase(it->second);
+            }
+            lru.push_front(Entry{key, keep, bytes});
+            index[key] = lru.begin();
+            used += bytes->size();
+            trim();
+            return bytes;
+        }
+
+    public:
+        // Decompressed bytes of a compressed blob whose content is raw_len bytes long
+        std::shared_ptr<const std::string> get(const BlobRef &compressed, size_t raw_len){
+            return lookup((uint64_t)(uintptr_t)compressed.get(), compressed, [&]{ return lz_decompress(compressed.view(), raw_len); });
+        }
+
+        // Bytes of a version whose bytes are in the segment store under segment_key; load()
+        // reads (and if need be decompresses) them
+        template <typename Load>
+        std::shared_ptr<const std::string> get_segment(uint64_t segment_key, Load load){
+            return lookup(segment_key * 2 + 1, BlobRef(), load);
+        }
+
+        // Set the budget in bytes (0 disables caching)
+        void set_capacity(size_t bytes){
+            std::lock_guard<std::mutex> lk(lock);
+            cap = bytes;
+            trim();
+        }
+
+        // Forget every entry
+        void clear(){
+            std::lock_guard<std::mutex> lk(lock);
+            lru.clear();
+            index.clear();
+            used = 0;
+        }
+
+        size_t size_bytes(){ std::lock_guard<std::mutex> lk(lock); return used; }
+        uint64_t hits(){ std::lock_guard<std::mutex> lk(lock); return hit_count; }
+        uint64_t misses(){ std::lock_guard<std::mutex> lk(lock); return miss_count; }
+};
+
+#endif // COLD_CACHE_H
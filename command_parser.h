@@ -0,0 +1,141 @@
+//
+// Command-line tokenizer and command lookup for the CLI.
+//
+// tokenize() splits a line into at most three string_views pointing into the
+// caller's buffer (nothing is copied): the command, the file name / first
+// argument, and "the rest of the line". Tokens are separated by spaces, tabs or
+// newlines; after the second token, everything past the single separator that
+// ends it is kept verbatim as the third token (including further whitespace).
+//
+// lookup_command() maps a command word to a Command with a switch on its
+// length followed by one comparison, so dispatch never walks a list of strings.
+//
+
+#ifndef COMMAND_PARSER_H
+#define COMMAND_PARSER_H
+
+#include <cstddef>
+#include <string_view>
+
+enum class Command {
+    UNKNOWN,
+    HELP, EXIT, BATCH,
+    CREATE, READ, INSERT, UPDATE, SNAPSHOT, ROLLBACK, HISTORY,
+    RECENT_FILES, BIGGEST_TREES,
+    SAVE, LOAD, CHECKPOINT, IMPORT,
+    COMMON_ANCESTOR, DIFF,
+    BRANCH, TAG, CHECKOUT, REFS,
+    GC, PRUNE, STATS, SEARCH,
+    BEGIN, COMMIT, ABORT, SNAPSHOT_ALL
+};
+
+// Command words, indexed by Command ("" for UNKNOWN)
+inline constexpr const char* COMMAND_NAMES[] = {
+    "",
+    "HELP", "EXIT", "BATCH",
+    "CREATE", "READ", "INSERT", "UPDATE", "SNAPSHOT", "ROLLBACK", "HISTORY",
+    "RECENT_FILES", "BIGGEST_TREES",
+    "SAVE", "LOAD", "CHECKPOINT", "IMPORT",
+    "COMMON_ANCESTOR", "DIFF",
+    "BRANCH", "TAG", "CHECKOUT", "REFS",
+    "GC", "PRUNE", "STATS", "SEARCH",
+    "BEGIN", "COMMIT", "ABORT", "SNAPSHOT_ALL"
+};
+constexpr size_t COMMAND_COUNT = sizeof(COMMAND_NAMES) / sizeof(COMMAND_NAMES[0]);
+static_assert(COMMAND_COUNT == static_cast<size_t>(Command::SNAPSHOT_ALL) + 1, "COMMAND_NAMES must list every Command");
+
+// A tokenized command line: tok[0..count-1] are valid
+struct CommandLine
+{
+    std::string_view tok[3];
+    int count = 0;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    std::string_view operator[](int i) const { return tok[i]; }
+};
+
+inline bool is_separator(char c){ return c == ' ' || c == '\t' || c == '\n'; }
+
+// Split line into command, first argument and rest-of-line
+inline CommandLine tokenize(std::string_view line){
+    CommandLine cl;
+    size_t i = 0, n = line.size();
+    while(cl.count < 2){
+        while(i < n && is_separator(line[i])) ++i;
+        if(i == n) return cl;
+        size_t start = i;
+        while(i < n && !is_separator(line[i])) ++i;
+        cl.tok[cl.count++] = line.substr(start, i - start);
+    }
+    if(i + 1 < n){
+        cl.tok[2] = line.substr(i + 1);
+        cl.count = 3;
+    }
+    return cl;
+}
+
+// Map a command word to its Command (UNKNOWN if not recognised)
+inline Command lookup_command(std::string_view w){
+    switch(w.size()){
+        case 2:
+            if(w == "GC") return Command::GC;
+            break;
+        case 3:
+            if(w == "TAG") return Command::TAG;
+            break;
+        case 4:
+            if(w == "READ") return Command::READ;
+            if(w == "HELP") return Command::HELP;
+            if(w == "EXIT") return Command::EXIT;
+            if(w == "SAVE") return Command::SAVE;
+            if(w == "LOAD") return Command::LOAD;
+            if(w == "DIFF") return Command::DIFF;
+            if(w == "REFS") return Command::REFS;
+            break;
+        case 5:
+            if(w == "BATCH") return Command::BATCH;
+            if(w == "PRUNE") return Command::PRUNE;
+            if(w == "STATS") return Command::STATS;
+            if(w == "BEGIN") return Command::BEGIN;
+            if(w == "ABORT") return Command::ABORT;
+            break;
+        case 6:
+            if(w[0] == 'C'){
+                if(w == "CREATE") return Command::CREATE;
+                if(w == "COMMIT") return Command::COMMIT;
+            }
+            else if(w[0] == 'I'){
+                if(w == "INSERT") return Command::INSERT;
+                if(w == "IMPORT") return Command::IMPORT;
+            }
+            else if(w[0] == 'B'){ if(w == "BRANCH") return Command::BRANCH; }
+            else if(w[0] == 'S'){ if(w == "SEARCH") return Command::SEARCH; }
+            else if(w == "UPDATE") return Command::UPDATE;
+            break;
+        case 7:
+            if(w == "HISTORY") return Command::HISTORY;
+            break;
+        case 8:
+            if(w[0] == 'S'){ if(w == "SNAPSHOT") return Command::SNAPSHOT; }
+            else if(w[0] == 'C'){ if(w == "CHECKOUT") return Command::CHECKOUT; }
+            else if(w == "ROLLBACK") return Command::ROLLBACK;
+            break;
+        case 10:
+            if(w == "CHECKPOINT") return Command::CHECKPOINT;
+            break;
+        case 12:
+            if(w == "RECENT_FILES") return Command::RECENT_FILES;
+            if(w == "SNAPSHOT_ALL") return Command::SNAPSHOT_ALL;
+            break;
+        case 13:
+            if(w == "BIGGEST_TREES") return Command::BIGGEST_TREES;
+            break;
+        case 15:
+            if(w == "COMMON_ANCESTOR") return Command::COMMON_ANCESTOR;
+            break;
+    }
+    return Command::UNKNOWN;
+}
+
+#endif // COMMAND_PARSER_H
@@ -0,0 +1,9 @@
+@echo off
+REM Compile version_control_system_bench.cpp using g++ (optimized, for meaningful timings)
+g++ -std=c++17 -O2 -g version_control_system_bench.cpp -o version_control_system_bench.exe -pthread
+if %errorlevel% neq 0 (
+    echo Compilation failed.
+    exit /b %errorlevel%
+) else (
+    echo Compilation successful. Output: version_control_system_bench.exe
+)
@@ -0,0 +1,9 @@
+#!/bin/bash
+# Compile version_control_system_bench.cpp using g++ (optimized, for meaningful timings)
+g++ -std=c++17 -O2 -g version_control_system_bench.cpp -o version_control_system_bench.exe -pthread
+if [ $? -ne 0 ]; then
+	echo "Compilation failed."
+	exit 1
+else
+	echo "Compilation successful. Output: version_control_system_bench.exe"
+fi
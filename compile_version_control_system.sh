@@ -1,7 +1,7 @@
 
 #!/bin/bash
 # Compile version_control_system.cpp using g++
-g++ -g version_control_system.cpp -o version_control_system.exe
+g++ -std=c++17 -g version_control_system.cpp -o version_control_system.exe -pthread
 if [ $? -ne 0 ]; then
 	echo "Compilation failed."
 	exit 1
@@ -0,0 +1,269 @@
+//
+// Text comparison for DIFF.
+//
+// write_diff() compares two contents by line or by byte:
+//   1. The common prefix and suffix are skipped with 16-byte SSE2 compares
+//      (a plain loop elsewhere); in line mode both are cut back to whole lines.
+//   2. What remains is tokenized (each distinct line, or each byte, gets an id)
+//      and compared with Myers' O(ND) algorithm in its linear-space form
+//      (recursive middle snake). Past MAX_COST edit steps a region is reported
+//      as replaced wholesale, so very different inputs stay fast at the price
+//      of a larger, still correct, diff.
+// Output is a list of hunks in unified-diff numbering (1-based, no context):
+//     @@ -<start>,<count> +<start>,<count> @@
+//     -<removed line>          (line mode; raw bytes after '-' in byte mode)
+//     +<added line>
+//
+
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DIFF_HAVE_SSE2 1
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "output_sink.h"
+
+// Length of the common prefix of a[0..n) and b[0..n)
+inline size_t common_prefix(const char* a, const char* b, size_t n){
+    size_t i = 0;
+#ifdef DIFF_HAVE_SSE2
+    for(; i + 16 <= n; i += 16){
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+        if(diff != 0){
+#ifdef _MSC_VER
+            unsigned long bit;
+            _BitScanForward(&bit, diff);
+            return i + bit;
+#else
+            return i + __builtin_ctz(diff);
+#endif
+        }
+    }
+#endif
+    while(i < n && a[i] == b[i]) ++i;
+    return i;
+}
+
+// Length of the common suffix of a[0..n) and b[0..n) (same-length windows ending at a + n, b + n)
+inline size_t common_suffix(const char* a, const char* b, size_t n){
+    size_t i = 0;
+#ifdef DIFF_HAVE_SSE2
+    for(; i + 16 <= n; i += 16){
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + n - i - 16));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + n - i - 16));
+        unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+        if(diff != 0){
+#ifdef _MSC_VER
+            unsigned long bit;
+            _BitScanReverse(&bit, diff);
+            return i + (15 - bit);
+#else
+            return i + (__builtin_clz(diff) - 16);
+#endif
+        }
+    }
+#endif
+    while(i < n && a[n - i - 1] == b[n - i - 1]) ++i;
+    return i;
+}
+
+// One changed region: tokens [a_pos, a_pos + a_len) of a were replaced by [b_pos, b_pos + b_len) of b
+struct DiffHunk
+{
+    size_t a_pos, a_len, b_pos, b_len;
+};
+
+// Myers' diff of two token sequences in linear space
+class TokenDiff
+{
+    private:
+        static constexpr long MAX_COST = 1 << 14; // Edit steps explored per region before giving up
+
+        const uint32_t* a;
+        const uint32_t* b;
+        std::vector<DiffHunk> hunks;
+
+        void changed(size_t a_pos, size_t a_len, size_t b_pos, size_t b_len){
+            if(a_len == 0 && b_len == 0) return;
+            if(!hunks.empty()){
+                DiffHunk &h = hunks.back();
+                if(h.a_pos + h.a_len == a_pos && h.b_pos + h.b_len == b_pos){ h.a_len += a_len; h.b_len += b_len; return; }
+            }
+            hunks.push_back(DiffHunk{a_pos, a_len, b_pos, b_len});
+        }
+
+        // Compare a[a0, a1) with b[b0, b1), appending hunks in order
+        void compare(size_t a0, size_t a1, size_t b0, size_t b1){
+            while(a0 < a1 && b0 < b1 && a[a0] == b[b0]){ ++a0; ++b0; }
+            while(a0 < a1 && b0 < b1 && a[a1 - 1] == b[b1 - 1]){ --a1; --b1; }
+            if(a0 == a1 || b0 == b1){ changed(a0, a1 - a0, b0, b1 - b0); return; }
+
+            // Middle snake: run the forward and reverse searches until their paths overlap
+            long n = a1 - a0, m = b1 - b0;
+            long max_d = (n + m + 1) / 2;
+            long offset = max_d + 1;
+            std::vector<long> v1(2 * offset + 1, -1), v2(2 * offset + 1, -1);
+            v1[offset + 1] = 0;
+            v2[offset + 1] = 0;
+            long delta = n - m;
+            bool front = (delta & 1) != 0;
+            long k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+            const uint32_t* x = a + a0;
+            const uint32_t* y = b + b0;
+            for(long d = 0; d < max_d && d < MAX_COST; ++d){
+                for(long k1 = -d + k1start; k1 <= d - k1end; k1 += 2){
+                    long i = offset + k1;
+                    long x1 = (k1 == -d || (k1 != d && v1[i - 1] < v1[i + 1])) ? v1[i + 1] : v1[i - 1] + 1;
+                    long y1 = x1 - k1;
+                    while(x1 < n && y1 < m && x[x1] == y[y1]){ ++x1; ++y1; }
+                    v1[i] = x1;
+                    if(x1 > n) k1end += 2;
+                    else if(y1 > m) k1start += 2;
+                    else if(front){
+                        long j = offset + delta - k1;
+                        if(j >= 0 && j < (long)v2.size() && v2[j] != -1 && x1 >= n - v2[j]){
+                            compare(a0, a0 + x1, b0, b0 + y1);
+                            compare(a0 + x1, a1, b0 + y1, b1);
+                            return;
+                        }
+                    }
+                }
+                for(long k2 = -d + k2start; k2 <= d - k2end; k2 += 2){
+                    long i = offset + k2;
+                    long x2 = (k2 == -d || (k2 != d && v2[i - 1] < v2[i + 1])) ? v2[i + 1] : v2[i - 1] + 1;
+                    long y2 = x2 - k2;
+                    while(x2 < n && y2 < m && x[n - x2 - 1] == y[m - y2 - 1]){ ++x2; ++y2; }
+                    v2[i] = x2;
+                    if(x2 > n) k2end += 2;
+                    else if(y2 > m) k2start += 2;
+                    else if(!front){
+                        long j = offset + delta - k2;
+                        if(j >= 0 && j < (long)v1.size() && v1[j] != -1){
+                            long x1 = v1[j];
+                            long y1 = x1 - (j - offset);
+                            if(x1 >= n - x2){
+                                compare(a0, a0 + x1, b0, b0 + y1);
+                                compare(a0 + x1, a1, b0 + y1, b1);
+                                return;
+                            }
+                        }
+                    }
+                }
+            }
+            // Nothing in common found within the budget
+            changed(a0, n, b0, m);
+        }
+
+    public:
+        // Hunks turning a[0, n) into b[0, m)
+        static std::vector<DiffHunk> run(const uint32_t* a, size_t n, const uint32_t* b, size_t m){
+            TokenDiff t;
+            t.a = a;
+            t.b = b;
+            t.compare(0, n, 0, m);
+            return t.hunks;
+        }
+};
+
+struct DiffStats
+{
+    size_t hunks = 0;
+    size_t removed = 0; // Lines or bytes
+    size_t added = 0;
+};
+
+// Split s into lines, each with its '\n' (a last line without one is a different line than
+// the same text with it); a last line without '\n' counts too
+inline std::vector<std::string_view> split_lines(std::string_view s){
+    std::vector<std::string_view> lines;
+    size_t start = 0;
+    while(start < s.size()){
+        const void* nl = std::memchr(s.data() + start, '\n', s.size() - start);
+        size_t end = nl ? static_cast<const char*>(nl) - s.data() + 1 : s.size();
+        lines.push_back(s.substr(start, end - start));
+        start = end;
+    }
+    return lines;
+}
+
+// One diff line: marker, the line, and git's note if it has no '\n'
+inline void write_diff_line(OutputSink &out, char marker, std::string_view line){
+    out << marker << line;
+    if(line.empty() || line.back() != '\n') out << '\n' << "\\ No newline at end of file" << '\n';
+}
+
+// Write the hunks turning a into b to out. known_prefix: bytes a and b are already known to
+// share (e.g. from delta storage), which the prefix scan then skips.
+inline DiffStats write_diff(std::string_view a, std::string_view b, bool by_line, OutputSink &out, size_t known_prefix = 0){
+    DiffStats st;
+    size_t shortest = a.size() < b.size() ? a.size() : b.size();
+    if(known_prefix > shortest) known_prefix = shortest;
+    size_t pre = known_prefix + common_prefix(a.data() + known_prefix, b.data() + known_prefix, shortest - known_prefix);
+    if(pre == a.size() && pre == b.size()) return st;
+    // The suffix windows must not reach back into the prefix
+    size_t room = shortest - pre;
+    size_t suf = common_suffix(a.data() + a.size() - room, b.data() + b.size() - room, room);
+    size_t a_line = 1, b_line = 1; // Numbering of the first line / byte after the prefix
+    if(by_line){
+        // Keep only whole lines: the prefix ends after a '\n', the suffix starts after one in both
+        while(pre > 0 && a[pre - 1] != '\n') --pre;
+        for(size_t i = 0; i < pre; ++i) if(a[i] == '\n') ++a_line;
+        b_line = a_line;
+        while(suf > 0){
+            size_t as = a.size() - suf, bs = b.size() - suf;
+            bool a_start = as == 0 || a[as - 1] == '\n';
+            bool b_start = bs == 0 || b[bs - 1] == '\n';
+            if(a_start && b_start) break;
+            --suf;
+        }
+    }
+    else{
+        a_line = b_line = pre + 1;
+    }
+    std::string_view am = a.substr(pre, a.size() - pre - suf);
+    std::string_view bm = b.substr(pre, b.size() - pre - suf);
+
+    std::vector<uint32_t> ta, tb;
+    std::vector<std::string_view> la, lb;
+    if(by_line){
+        la = split_lines(am);
+        lb = split_lines(bm);
+        std::unordered_map<std::string_view, uint32_t> ids;
+        for(std::string_view l : la) ta.push_back(ids.emplace(l, (uint32_t)ids.size()).first->second);
+        for(std::string_view l : lb) tb.push_back(ids.emplace(l, (uint32_t)ids.size()).first->second);
+    }
+    else{
+        for(unsigned char c : am) ta.push_back(c);
+        for(unsigned char c : bm) tb.push_back(c);
+    }
+    for(const DiffHunk &h : TokenDiff::run(ta.data(), ta.size(), tb.data(), tb.size())){
+        ++st.hunks;
+        st.removed += h.a_len;
+        st.added += h.b_len;
+        // Unified numbering: an empty side is numbered by the line before it
+        out << "@@ -" << a_line + h.a_pos - (h.a_len == 0) << ',' << h.a_len
+            << " +" << b_line + h.b_pos - (h.b_len == 0) << ',' << h.b_len << " @@" << '\n';
+        if(by_line){
+            for(size_t i = 0; i < h.a_len; ++i) write_diff_line(out, '-', la[h.a_pos + i]);
+            for(size_t i = 0; i < h.b_len; ++i) write_diff_line(out, '+', lb[h.b_pos + i]);
+        }
+        else{
+            if(h.a_len) out << '-' << am.substr(h.a_pos, h.a_len) << '\n';
+            if(h.b_len) out << '+' << bm.substr(h.b_pos, h.b_len) << '\n';
+        }
+    }
+    return st;
+}
+
+#endif // DIFF_H
@@ -0,0 +1,126 @@
+//
+// EpochDomain: epoch-based reclamation for lock-free readers.
+//
+// Readers pin the current epoch (EpochGuard) for as long as they use pointers
+// loaded from shared atomics. A writer that unpublishes an object retires it
+// instead of deleting it; the object is tagged with the epoch it was retired
+// in and freed once every pinned reader has moved past that epoch, i.e. once
+// no reader can still hold it.
+//
+// Each thread gets a slot in a lock-free, append-only list the first time it
+// pins; the slot is handed back (and reused) when the thread exits. Pinning is
+// two atomic stores, so readers never block. Retired objects are freed in
+// batches by whichever writer retires the RECLAIM_BATCH'th object. A thread
+// caches its slot, so a program uses a single domain.
+//
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class EpochDomain
+{
+    private:
+        static constexpr size_t RECLAIM_BATCH = 64;
+
+        struct alignas(64) Slot
+        {
+            std::atomic<uint64_t> epoch{0}; // Pinned epoch, 0 while the thread is outside any guard
+            std::atomic<bool> in_use{true};
+            Slot* next = nullptr;
+            int depth = 0; // Nested guards of the owning thread
+        };
+
+        struct Retired
+        {
+            uint64_t epoch;
+            void* ptr;
+            void (*destroy)(void*);
+        };
+
+        std::atomic<uint64_t> global{1};
+        std::atomic<Slot*> slots{nullptr};
+        std::mutex limbo_mutex;
+        std::vector<Retired> limbo;
+
+        // This thread's slot: claimed on first use, released when the thread exits
+        Slot* local(){
+            struct Owner
+            {
+                Slot* slot = nullptr;
+                ~Owner(){ if(slot) slot->in_use.store(false, std::memory_order_release); }
+            };
+            static thread_local Owner owner;
+            if(owner.slot != nullptr) return owner.slot;
+            for(Slot* s = slots.load(std::memory_order_acquire); s != nullptr; s = s->next){
+                bool expected = false;
+                if(s->in_use.compare_exchange_strong(expected, true)) return owner.slot = s;
+            }
+            Slot* s = new Slot;
+            s->next = slots.load(std::memory_order_relaxed);
+            while(!slots.compare_exchange_weak(s->next, s, std::memory_order_acq_rel)) {}
+            return owner.slot = s;
+        }
+
+        // Free every retired object older than the oldest pinned epoch (limbo_mutex held)
+        void reclaim(){
+            uint64_t oldest = UINT64_MAX;
+            for(Slot* s = slots.load(std::memory_order_acquire); s != nullptr; s = s->next){
+                uint64_t e = s->epoch.load(std::memory_order_seq_cst);
+                if(e != 0 && e < oldest) oldest = e;
+            }
+            size_t kept = 0;
+            for(Retired &r : limbo){
+                if(r.epoch < oldest) r.destroy(r.ptr);
+                else limbo[kept++] = r;
+            }
+            limbo.resize(kept);
+        }
+
+    public:
+        EpochDomain() {}
+        EpochDomain(const EpochDomain &) = delete;
+        EpochDomain &operator=(const EpochDomain &) = delete;
+        ~EpochDomain(){
+            for(Retired &r : limbo) r.destroy(r.ptr);
+            Slot* s = slots.load();
+            while(s != nullptr){ Slot* n = s->next; delete s; s = n; }
+        }
+
+        void pin(){
+            Slot* s = local();
+            if(s->depth++ == 0) s->epoch.store(global.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        }
+        void unpin(){
+            Slot* s = local();
+            if(--s->depth == 0) s->epoch.store(0, std::memory_order_release);
+        }
+
+        // Hand p to the domain once it can no longer be reached through any shared pointer
+        template <typename T>
+        void retire(T* p){
+            uint64_t e = global.fetch_add(1, std::memory_order_seq_cst);
+            std::lock_guard<std::mutex> lk(limbo_mutex);
+            limbo.push_back(Retired{e, p, [](void* q){ delete static_cast<T*>(q); }});
+            if(limbo.size() >= RECLAIM_BATCH) reclaim();
+        }
+};
+
+// Pins the current epoch for its lifetime
+class EpochGuard
+{
+    private:
+        EpochDomain &domain;
+
+    public:
+        explicit EpochGuard(EpochDomain &d) : domain(d) { domain.pin(); }
+        EpochGuard(const EpochGuard &) = delete;
+        EpochGuard &operator=(const EpochGuard &) = delete;
+        ~EpochGuard(){ domain.unpin(); }
+};
+
+#endif // EPOCH_H
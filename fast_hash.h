@@ -0,0 +1,48 @@
+//
+// Fast non-cryptographic 64-bit hashing shared by the in-memory indexes.
+//
+// The hash consumes 8 bytes per step with a multiply/xor mix and finishes with
+// the MurmurHash3 64-bit finalizer, so names that only differ in a few middle
+// characters (log_0001.txt, log_0002.txt, ...) still spread over the table.
+//
+
+#ifndef FAST_HASH_H
+#define FAST_HASH_H
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// MurmurHash3 finalizer: full avalanche of a 64-bit value
+inline uint64_t hash_mix64(uint64_t k){
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// Hash an arbitrary byte range
+inline uint64_t fast_hash64(const void* data, size_t len, uint64_t seed = 0){
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const uint64_t m = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = seed ^ (len * m);
+    while(len >= 8){
+        uint64_t k;
+        std::memcpy(&k, p, 8);
+        h = (h ^ hash_mix64(k)) * m;
+        p += 8;
+        len -= 8;
+    }
+    uint64_t tail = 0;
+    for(size_t i = 0; i < len; ++i) tail |= uint64_t(p[i]) << (8 * i);
+    h = (h ^ hash_mix64(tail ^ len)) * m;
+    return hash_mix64(h);
+}
+
+inline uint64_t fast_hash64(std::string_view s, uint64_t seed = 0){
+    return fast_hash64(s.data(), s.size(), seed);
+}
+
+#endif // FAST_HASH_H
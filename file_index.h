@@ -0,0 +1,181 @@
+//
+// FileIndex: filename -> File* lookup table used by the command loop.
+//
+// Open addressing with linear probing and a Swiss-table style control byte per
+// slot (7 bits of the hash, or EMPTY / DELETED). A probe compares control bytes
+// first, then the full precomputed 64-bit hash, and only then the name, so the
+// cost of a lookup does not depend on how similar the stored names are.
+// Lookups take std::string_view, so callers never build a temporary string.
+// The table starts with no storage and grows by doubling at 7/8 load.
+//
+// Thread safety: one writer at a time (insert / erase; the caller serializes
+// them), while find() runs concurrently without any lock. A slot is filled in
+// before its control byte is published, a filled slot is never written again
+// (erase only marks it DELETED; it is dropped at the next rehash), and a rehash
+// builds a new table, swaps it in and retires the old one to an EpochDomain,
+// so a reader pinned in find() can keep probing the table it started on.
+// The other methods are for the writer side only.
+//
+
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "epoch.h"
+#include "fast_hash.h"
+#include "storage_policy.h"
+
+class FileIndex
+{
+    private:
+        static constexpr uint8_t EMPTY = 0x80;
+        static constexpr uint8_t DELETED = 0xFE;
+
+        struct Slot {
+            uint64_t hash;
+            std::string name;
+            File* file;
+        };
+
+        struct Table {
+            size_t cap;
+            std::unique_ptr<std::atomic<uint8_t>[]> ctrl; // One control byte per slot
+            std::unique_ptr<Slot[]> slots;
+            explicit Table(size_t n) : cap(n), ctrl(new std::atomic<uint8_t>[n]), slots(new Slot[n]) {
+                for(size_t i = 0; i < n; ++i) ctrl[i].store(EMPTY, std::memory_order_relaxed);
+            }
+        };
+
+        EpochDomain &epochs;            // Retired tables wait here for readers still probing them
+        std::atomic<Table*> table{nullptr};
+        size_t used = 0;           // Live entries
+        size_t tombstones = 0;     // DELETED control bytes
+
+        static uint8_t tag_of(uint64_t h){ return uint8_t(h & 0x7F); }
+
+        // Slot of t holding name, or npos if absent
+        static size_t locate(const Table* t, std::string_view name, uint64_t h){
+            if(t == nullptr) return npos;
+            size_t mask = t->cap - 1;
+            uint8_t tag = tag_of(h);
+            for(size_t i = (h >> 7) & mask; ; i = (i + 1) & mask){
+                uint8_t c = t->ctrl[i].load(std::memory_order_acquire);
+                if(c == EMPTY) return npos;
+                if(c == tag && t->slots[i].hash == h && t->slots[i].name == name) return i;
+            }
+        }
+
+        // The table as the writer sees it
+        Table* current() const { return table.load(std::memory_order_relaxed); }
+
+        void rehash(size_t new_cap){
+            Table* old = current();
+            Table* t = new Table(new_cap);
+            size_t mask = new_cap - 1;
+            for(size_t k = 0; old != nullptr && k < old->cap; ++k){
+                if(old->ctrl[k].load(std::memory_order_relaxed) & 0x80) continue;
+                const Slot &s = old->slots[k];
+                size_t i = (s.hash >> 7) & mask;
+                while(t->ctrl[i].load(std::memory_order_relaxed) != EMPTY) i = (i + 1) & mask;
+                t->ctrl[i].store(tag_of(s.hash), std::memory_order_relaxed);
+                t->slots[i] = s; // Copied: readers may still be comparing the old names
+            }
+            tombstones = 0;
+            table.store(t, std::memory_order_release);
+            if(old != nullptr) epochs.retire(old);
+        }
+
+    public:
+        static constexpr size_t npos = size_t(-1);
+
+        explicit FileIndex(EpochDomain &domain) : epochs(domain) {}
+        FileIndex(const FileIndex &) = delete;
+        FileIndex &operator=(const FileIndex &) = delete;
+        ~FileIndex(){ delete current(); }
+
+        static uint64_t hash_name(std::string_view name){ return fast_hash64(name); }
+
+        // Number of files stored
+        size_t size() const { return used; }
+
+        // Number of allocated slots (0 until the first insert)
+        size_t capacity() const { return current() ? current()->cap : 0; }
+
+        // Find a file by name; returns nullptr if not present. Lock-free: safe alongside a writer.
+        File* find(std::string_view name) const { return find(name, hash_name(name)); }
+        File* find(std::string_view name, uint64_t h) const {
+            EpochGuard pinned(epochs);
+            const Table* t = table.load(std::memory_order_acquire);
+            size_t i = locate(t, name, h);
+            return i == npos ? nullptr : t->slots[i].file;
+        }
+
+        // Insert name -> f; returns false (and stores nothing) if name already exists
+        bool insert(std::string_view name, File* f){ return insert(name, hash_name(name), f); }
+        bool insert(std::string_view name, uint64_t h, File* f){
+            if(locate(current(), name, h) != npos) return false;
+            if((used + tombstones + 1) * 8 > capacity() * 7){
+                size_t cap = capacity() == 0 ? 16 : capacity();
+                // Only grow when live entries need it; otherwise just drop tombstones
+                while((used + 1) * 2 > cap) cap *= 2;
+                rehash(cap);
+            }
+            Table* t = current();
+            size_t mask = t->cap - 1;
+            size_t i = (h >> 7) & mask;
+            // Only EMPTY slots are filled: a DELETED one may still be read by a concurrent find()
+            while(t->ctrl[i].load(std::memory_order_relaxed) != EMPTY) i = (i + 1) & mask;
+            t->slots[i].hash = h;
+            t->slots[i].name.assign(name.data(), name.size());
+            t->slots[i].file = f;
+            t->ctrl[i].store(tag_of(h), std::memory_order_release);
+            ++used;
+            return true;
+        }
+
+        // Remove name; returns the File* it mapped to, or nullptr if absent
+        File* erase(std::string_view name){
+            Table* t = current();
+            size_t i = locate(t, name, hash_name(name));
+            if(i == npos) return nullptr;
+            File* f = t->slots[i].file;
+            t->ctrl[i].store(DELETED, std::memory_order_release);
+            --used;
+            ++tombstones;
+            return f;
+        }
+
+        // Slots marked DELETED, reclaimed at the next rehash
+        size_t deleted() const { return tombstones; }
+
+        // Probe lengths of the live entries: the sum and the longest distance from an entry's home slot
+        void probe_lengths(size_t &total, size_t &longest) const {
+            total = longest = 0;
+            const Table* t = current();
+            if(t == nullptr) return;
+            size_t mask = t->cap - 1;
+            for(size_t i = 0; i < t->cap; ++i){
+                if(t->ctrl[i].load(std::memory_order_relaxed) & 0x80) continue;
+                size_t d = (i - (t->slots[i].hash >> 7)) & mask;
+                total += d;
+                longest = std::max(longest, d);
+            }
+        }
+
+        // Visit every (name, File*) pair in unspecified order
+        template <typename Fn>
+        void for_each(Fn fn) const {
+            const Table* t = current();
+            for(size_t i = 0; t != nullptr && i < t->cap; ++i){
+                if(!(t->ctrl[i].load(std::memory_order_relaxed) & 0x80)) fn(t->slots[i].name, t->slots[i].file);
+            }
+        }
+};
+
+#endif // FILE_INDEX_H
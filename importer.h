@@ -0,0 +1,237 @@
+//
+// Bulk import sources for IMPORT.
+//
+// An ImportPlan lists files and, for each, the contents and messages of the
+// versions to create. It is built without touching the version store, so a
+// failing import (unreadable file, broken repository, name clash) changes
+// nothing.
+//
+//   scan_directory()    every regular file below a directory becomes a file
+//                       with one version (its current content); files are
+//                       read in parallel.
+//   scan_git_history()  every path ever committed on the first-parent history
+//                       of a Git repository becomes a file with one version
+//                       per commit that changed it (message and time taken
+//                       from the commit). Runs the git command-line tool.
+//
+// File names are paths relative to the root with '/' separators. Paths that
+// contain whitespace cannot be named in a command and are skipped.
+//
+
+#ifndef IMPORTER_H
+#define IMPORTER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "clock.h"
+#include "thread_pool.h"
+
+struct ImportVersion
+{
+    size_t content;      // Index in ImportPlan::contents
+    std::string message; // Snapshot message
+    Timestamp ts;        // Creation and snapshot time
+};
+
+struct ImportFile
+{
+    std::string name;
+    std::vector<ImportVersion> versions; // Oldest first
+};
+
+struct ImportPlan
+{
+    std::vector<ImportFile> files;
+    std::vector<std::string> contents; // Distinct contents, shared by versions
+    size_t skipped = 0;                // Paths that cannot be used as file names
+};
+
+// True if path can be used as a file name in commands (non-empty, no separators)
+inline bool importable_name(std::string_view name){
+    if(name.empty()) return false;
+    for(char c : name) if(c == ' ' || c == '\t' || c == '\n' || c == '\r') return false;
+    return true;
+}
+
+inline bool read_whole_file(const std::filesystem::path &p, std::string &out){
+    FILE* f = std::fopen(p.string().c_str(), "rb");
+    if(f == nullptr) return false;
+    char chunk[1 << 16];
+    size_t n;
+    while((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0) out.append(chunk, n);
+    bool ok = !std::ferror(f);
+    std::fclose(f);
+    return ok;
+}
+
+// Every regular file below root (skipping .git directories), snapshotted with message at time ts
+inline ImportPlan scan_directory(const std::string &root, const std::string &message, Timestamp ts, ThreadPool &pool){
+    namespace fs = std::filesystem;
+    ImportPlan plan;
+    std::vector<fs::path> paths;
+    std::error_code ec;
+    if(!fs::is_directory(root, ec)) throw std::runtime_error("Cannot read directory: " + root);
+    fs::recursive_directory_iterator it(root, ec), end;
+    if(ec) throw std::runtime_error("Cannot read directory: " + root);
+    for(; it != end; it.increment(ec)){
+        if(ec) throw std::runtime_error("Cannot read directory: " + root);
+        if(it->path().filename() == ".git"){ it.disable_recursion_pending(); continue; }
+        if(!it->is_regular_file(ec)) continue;
+        std::string name = it->path().lexically_relative(root).generic_string();
+        if(!importable_name(name)){ ++plan.skipped; continue; }
+        paths.push_back(it->path());
+        plan.files.push_back(ImportFile{name, {ImportVersion{plan.files.size(), message, ts}}});
+    }
+    plan.contents.resize(paths.size());
+    pool.parallel_for(paths.size(), [&](size_t i){
+        if(!read_whole_file(paths[i], plan.contents[i])) throw std::runtime_error("Cannot read file: " + paths[i].string());
+    });
+    return plan;
+}
+
+// Quote an argument for the shell popen() runs
+inline std::string shell_quote(const std::string &s){
+#ifdef _WIN32
+    return "\"" + s + "\"";
+#else
+    std::string q = "'";
+    for(char c : s){ if(c == '\'') q += "'\\''"; else q += c; }
+    return q + "'";
+#endif
+}
+
+// Run a shell command and return everything it writes to stdout
+// (its error messages are discarded; failure is reported as an exception)
+inline std::string run_capture(const std::string &cmd, const std::string &what){
+#ifdef _WIN32
+    FILE* p = _popen((cmd + " 2>NUL").c_str(), "rb");
+#else
+    FILE* p = popen((cmd + " 2>/dev/null").c_str(), "r");
+#endif
+    if(p == nullptr) throw std::runtime_error("Cannot read git repository: " + what);
+    std::string out;
+    char chunk[1 << 16];
+    size_t n;
+    while((n = std::fread(chunk, 1, sizeof(chunk), p)) > 0) out.append(chunk, n);
+#ifdef _WIN32
+    int status = _pclose(p);
+#else
+    int status = pclose(p);
+#endif
+    if(status != 0) throw std::runtime_error("Cannot read git repository: " + what);
+    return out;
+}
+
+// One version per commit that touched each path, along the first-parent history of repo's HEAD
+inline ImportPlan scan_git_history(const std::string &repo){
+    ImportPlan plan;
+    std::string git = "git -C " + shell_quote(repo);
+    // -z output: "\1<time> <subject>\0" per commit, then ":<mode> <mode> <old> <new> <status>\0<path>\0"
+    // per changed path (merges are diffed against their first parent)
+    std::string log = run_capture(git + " log --reverse --first-parent --diff-merges=first-parent --no-renames"
+                                  " --raw --no-abbrev -z --format=%x01%ct%x20%s", repo);
+
+    struct Change { size_t file; std::string blob; std::string message; Timestamp ts; };
+    std::vector<Change> changes;
+    std::unordered_map<std::string, size_t> file_of; // path -> index in plan.files
+    std::unordered_map<std::string, size_t> content_of; // blob id -> index in plan.contents
+    std::vector<std::string> wanted; // Blob ids to fetch, in content index order
+    std::string message;
+    Timestamp ts = 0;
+    size_t pos = 0;
+    auto next_token = [&](std::string_view &tok){
+        if(pos >= log.size()) return false;
+        size_t z = log.find('\0', pos);
+        if(z == std::string::npos) z = log.size();
+        tok = std::string_view(log.data() + pos, z - pos);
+        pos = z + 1;
+        while(!tok.empty() && tok.front() == '\n') tok.remove_prefix(1);
+        return true;
+    };
+    std::string_view tok;
+    while(next_token(tok)){
+        if(tok.empty()) continue;
+        if(tok.front() == '\1'){
+            tok.remove_prefix(1);
+            size_t sp = tok.find(' ');
+            ts = std::stoll(std::string(tok.substr(0, sp))) * NS_PER_SECOND;
+            message = sp == std::string_view::npos ? "" : std::string(tok.substr(sp + 1));
+            continue;
+        }
+        if(tok.front() != ':') throw std::runtime_error("Cannot read git repository: " + repo);
+        // ":<old mode> <new mode> <old id> <new id> <status>"
+        std::vector<std::string_view> f;
+        for(size_t a = 1; a <= tok.size(); ){
+            size_t b = tok.find(' ', a);
+            if(b == std::string_view::npos) b = tok.size();
+            f.push_back(tok.substr(a, b - a));
+            a = b + 1;
+        }
+        std::string_view path;
+        if(f.size() != 5 || !next_token(path)) throw std::runtime_error("Cannot read git repository: " + repo);
+        bool deleted = f[4] == "D";
+        std::string_view mode = deleted ? f[0] : f[1];
+        if(mode != "100644" && mode != "100755") continue; // Symlinks and submodules
+        std::string name(path);
+        if(!importable_name(name)){ ++plan.skipped; continue; }
+        auto it = file_of.find(name);
+        if(it == file_of.end()){
+            it = file_of.emplace(name, plan.files.size()).first;
+            plan.files.push_back(ImportFile{name, {}});
+        }
+        std::string blob = deleted ? "" : std::string(f[3]);
+        changes.push_back(Change{it->second, blob, deleted ? message + " (deleted)" : message, ts});
+        if(!deleted && content_of.emplace(blob, wanted.size()).second) wanted.push_back(blob);
+    }
+
+    // Fetch every distinct blob in one git cat-file --batch run
+    plan.contents.resize(wanted.size() + 1); // Last slot: empty content of deletions
+    if(!wanted.empty()){
+        std::filesystem::path list = std::filesystem::temp_directory_path() / ("vcs_import_" + std::to_string(std::time(0)) + "_" + std::to_string((uintptr_t)&plan) + ".txt");
+        FILE* lf = std::fopen(list.string().c_str(), "wb");
+        if(lf == nullptr) throw std::runtime_error("Cannot read git repository: " + repo);
+        for(const std::string &id : wanted){ std::fputs(id.c_str(), lf); std::fputc('\n', lf); }
+        std::fclose(lf);
+        std::string batch;
+        try {
+            batch = run_capture(git + " cat-file --batch < " + shell_quote(list.string()), repo);
+        } catch(...) {
+            std::remove(list.string().c_str());
+            throw;
+        }
+        std::remove(list.string().c_str());
+        // "<id> blob <size>\n<bytes>\n" per blob, in request order
+        size_t at = 0;
+        for(size_t i = 0; i < wanted.size(); ++i){
+            size_t nl = batch.find('\n', at);
+            if(nl == std::string::npos) throw std::runtime_error("Cannot read git repository: " + repo);
+            std::string_view hdr(batch.data() + at, nl - at);
+            size_t sp = hdr.rfind(' ');
+            if(sp == std::string_view::npos || hdr.substr(0, hdr.find(' ')) != wanted[i]) throw std::runtime_error("Cannot read git repository: " + repo);
+            // An object git cannot find is reported as "<id> missing", with no bytes after it
+            if(hdr.substr(sp + 1) == "missing") throw std::runtime_error("Cannot read git repository: " + repo + " (missing object " + wanted[i] + ")");
+            std::string_view digits = hdr.substr(sp + 1);
+            if(digits.empty() || digits.size() > 19 || digits.find_first_not_of("0123456789") != std::string_view::npos) {
+                throw std::runtime_error("Cannot read git repository: " + repo);
+            }
+            size_t size = std::stoull(std::string(digits));
+            if(size > batch.size() - nl - 1) throw std::runtime_error("Cannot read git repository: " + repo);
+            plan.contents[i].assign(batch.data() + nl + 1, size);
+            at = nl + 1 + size + 1;
+        }
+    }
+    for(Change &c : changes){
+        size_t content = c.blob.empty() ? wanted.size() : content_of[c.blob];
+        plan.files[c.file].versions.push_back(ImportVersion{content, std::move(c.message), c.ts});
+    }
+    return plan;
+}
+
+#endif // IMPORTER_H
@@ -0,0 +1,86 @@
+//
+// LineReader: reads lines from a file descriptor in large blocks.
+//
+// Each read() call asks for up to a whole block; on a pipe or file that pulls
+// in many commands at once, while on a terminal it returns as soon as a line
+// has been typed, so the same reader serves batch and interactive use. Lines
+// are returned as string_views into the internal buffer (without the '\n'),
+// valid until the next call to next(). Mirrors getline(): a final line without
+// a trailing newline is still returned.
+//
+
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <string_view>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+class LineReader
+{
+    private:
+        int fd;
+        std::string buf;
+        size_t start = 0; // First unread byte
+        size_t end = 0;   // One past the last valid byte
+        bool eof = false;
+
+        long raw_read(char* p, size_t n){
+#ifdef _WIN32
+            return _read(fd, p, (unsigned)n);
+#else
+            return ::read(fd, p, n);
+#endif
+        }
+
+        // Pull more bytes into the buffer; returns false at end of input
+        bool fill(){
+            if(eof) return false;
+            if(start > 0){
+                std::memmove(&buf[0], buf.data() + start, end - start);
+                end -= start;
+                start = 0;
+            }
+            if(end == buf.size()) buf.resize(buf.size() * 2);
+            while(true){
+                long r = raw_read(&buf[end], buf.size() - end);
+                if(r < 0 && errno == EINTR) continue;
+                if(r <= 0){ eof = true; return false; }
+                end += r;
+                return true;
+            }
+        }
+
+    public:
+        explicit LineReader(int in_fd, size_t block = 1 << 20) : fd(in_fd), buf(block, '\0') {}
+
+        // Next line into line; returns false once input is exhausted
+        bool next(std::string_view &line){
+            size_t scanned = start;
+            while(true){
+                const void* nl = std::memchr(buf.data() + scanned, '\n', end - scanned);
+                if(nl != nullptr){
+                    size_t pos = static_cast<const char*>(nl) - buf.data();
+                    line = std::string_view(buf.data() + start, pos - start);
+                    start = pos + 1;
+                    return true;
+                }
+                scanned = end - start; // Offset survives the compaction in fill()
+                if(!fill()){
+                    if(start == end) return false;
+                    line = std::string_view(buf.data() + start, end - start);
+                    start = end;
+                    return true;
+                }
+                scanned += start;
+            }
+        }
+};
+
+#endif // LINE_READER_H
@@ -0,0 +1,129 @@
+//
+// A small, fast LZ77 byte codec (LZ4-style block format) for cold content.
+//
+// A compressed block is a series of sequences, each
+//     token        1 byte: literal count (high 4 bits), match length - 4 (low 4 bits)
+//     [lit ext]    if the literal count is 15: more bytes, each added, until one is not 255
+//     literals
+//     offset       2 bytes little-endian, 1..65535 back from the current end of output
+//     [match ext]  if the match field is 15: as for literals
+// The last sequence has literals only and ends the block. Matches are found
+// with a single-probe hash table of 4-byte prefixes, so compression is one
+// pass and decompression is a tight copy loop; the uncompressed size is kept
+// by the caller. lz_decompress() checks every length and offset and throws on
+// a malformed block instead of reading or writing out of bounds.
+//
+
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lz_detail {
+
+constexpr int HASH_BITS = 14;
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t MAX_OFFSET = 65535;
+constexpr size_t TAIL = 12; // Bytes at the end always sent as literals (no match starts there)
+
+inline uint32_t load32(const char* p){ uint32_t v; std::memcpy(&v, p, 4); return v; }
+inline uint32_t hash4(uint32_t v){ return (v * 2654435761u) >> (32 - HASH_BITS); }
+
+inline void put_length(std::string &out, size_t n){
+    while(n >= 255){ out += char(255); n -= 255; }
+    out += char(n);
+}
+
+// Append one sequence: literals lit[0..lit_len), then (unless last) a match of match_len at offset
+inline void put_sequence(std::string &out, const char* lit, size_t lit_len, size_t offset, size_t match_len, bool last){
+    size_t m = last ? 0 : match_len - MIN_MATCH;
+    out += char(((lit_len < 15 ? lit_len : 15) << 4) | (m < 15 ? m : 15));
+    if(lit_len >= 15) put_length(out, lit_len - 15);
+    out.append(lit, lit_len);
+    if(last) return;
+    out += char(offset & 0xFF);
+    out += char(offset >> 8);
+    if(m >= 15) put_length(out, m - 15);
+}
+
+[[noreturn]] inline void corrupt(){ throw std::runtime_error("Corrupt compressed data"); }
+
+inline size_t get_length(std::string_view in, size_t &ip, size_t n){
+    if(n != 15) return n;
+    while(true){
+        if(ip >= in.size()) corrupt();
+        unsigned char b = in[ip++];
+        n += b;
+        if(b != 255) return n;
+    }
+}
+
+} // namespace lz_detail
+
+// Compress in; the result is never more than a few bytes per 255 larger than in
+inline std::string lz_compress(std::string_view in){
+    using namespace lz_detail;
+    std::string out;
+    out.reserve(in.size() / 2 + 16);
+    const char* src = in.data();
+    size_t n = in.size(), anchor = 0;
+    if(n > TAIL){
+        std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0); // Position + 1 of the last 4-byte prefix with this hash
+        size_t limit = n - TAIL;
+        for(size_t i = 0; i < limit; ){
+            uint32_t seq = load32(src + i);
+            uint32_t h = hash4(seq);
+            size_t cand = table[h];
+            table[h] = uint32_t(i + 1);
+            if(cand == 0 || i - (cand - 1) > MAX_OFFSET || load32(src + cand - 1) != seq){
+                i += 1 + ((i - anchor) >> 6); // Skip faster through incompressible runs
+                continue;
+            }
+            size_t m = cand - 1;
+            while(i > anchor && m > 0 && src[i - 1] == src[m - 1]){ --i; --m; }
+            size_t len = MIN_MATCH;
+            while(i + len < n - 5 && src[i + len] == src[m + len]) ++len;
+            put_sequence(out, src + anchor, i - anchor, i - m, len, false);
+            i += len;
+            anchor = i;
+        }
+    }
+    put_sequence(out, src + anchor, n - anchor, 0, 0, true);
+    return out;
+}
+
+// Decompress a block produced by lz_compress() from raw_len bytes of input
+inline std::string lz_decompress(std::string_view in, size_t raw_len){
+    using namespace lz_detail;
+    std::string out(raw_len, '\0');
+    char* dst = &out[0];
+    size_t ip = 0, op = 0;
+    while(true){
+        if(ip >= in.size()) corrupt();
+        unsigned char token = in[ip++];
+        size_t lit = get_length(in, ip, token >> 4);
+        if(lit > in.size() - ip || lit > raw_len - op) corrupt();
+        std::memcpy(dst + op, in.data() + ip, lit);
+        ip += lit;
+        op += lit;
+        if(ip == in.size()) break; // Last sequence
+        if(in.size() - ip < 2) corrupt();
+        size_t offset = (unsigned char)in[ip] | (size_t((unsigned char)in[ip + 1]) << 8);
+        ip += 2;
+        size_t len = get_length(in, ip, token & 15) + MIN_MATCH;
+        if(offset == 0 || offset > op || len > raw_len - op) corrupt();
+        const char* from = dst + op - offset;
+        if(offset >= len) std::memcpy(dst + op, from, len);
+        else for(size_t k = 0; k < len; ++k) dst[op + k] = from[k]; // Overlapping: repeats the last offset bytes
+        op += len;
+    }
+    if(op != raw_len) corrupt();
+    return out;
+}
+
+#endif // LZ_CODEC_H
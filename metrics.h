@@ -0,0 +1,160 @@
+//
+// Metrics: per-command counters and latency histograms for STATS.
+//
+// Every command run by run_command() is counted under its Command, together
+// with whether it failed and how long it took (lock waits included). Latencies
+// go into a histogram of power-of-two microsecond buckets, so recording is a
+// clock read and three relaxed atomic adds, and quantiles are read off as the
+// upper bound of the bucket they fall in. Each command's counters have a cache
+// line of their own, so threads running different commands do not contend.
+//
+// Build with -DVCS_METRICS=0 to compile the instrumentation out entirely:
+// CommandTimer is then empty and nothing is recorded (STATS still reports the
+// repository figures, which are only computed when asked for).
+//
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <string>
+#include "command_parser.h"
+#include "output_sink.h"
+
+#ifndef VCS_METRICS
+#define VCS_METRICS 1
+#endif
+
+class CommandMetrics
+{
+    public:
+        // Bucket b counts latencies below 2^b microseconds (and at least 2^(b-1) for b > 0);
+        // the last one also counts everything slower
+        static constexpr int BUCKETS = 28;
+
+        // Upper bound of bucket b in microseconds
+        static uint64_t bucket_bound_us(int b){ return uint64_t(1) << b; }
+
+    private:
+        struct alignas(64) Counters
+        {
+            std::atomic<uint64_t> count{0};
+            std::atomic<uint64_t> errors{0};
+            std::atomic<uint64_t> total_ns{0};
+            std::atomic<uint64_t> buckets[BUCKETS] = {};
+        };
+        Counters per_command[COMMAND_COUNT];
+
+        static int bucket_of(uint64_t ns){
+            uint64_t us = ns / 1000;
+            int b = 0;
+            while(us != 0 && b + 1 < BUCKETS){ us >>= 1; ++b; }
+            return b;
+        }
+
+        // Smallest bucket bound (us) below which a fraction q of the samples of c fall
+        static uint64_t quantile_us(const Counters &c, double q){
+            uint64_t n = c.count.load(std::memory_order_relaxed), seen = 0;
+            if(n == 0) return 0;
+            uint64_t want = uint64_t(q * n);
+            if(want < q * n || want == 0) ++want; // Rank of the sample: ceil(q * n), at least 1
+            int b = 0;
+            for(; b + 1 < BUCKETS; ++b){
+                seen += c.buckets[b].load(std::memory_order_relaxed);
+                if(seen >= want) break;
+            }
+            return bucket_bound_us(b);
+        }
+
+        static const char* label(size_t i){ return i == 0 ? "unknown" : COMMAND_NAMES[i]; }
+
+    public:
+        void record(Command cmd, uint64_t ns, bool failed){
+            Counters &c = per_command[static_cast<size_t>(cmd)];
+            c.count.fetch_add(1, std::memory_order_relaxed);
+            if(failed) c.errors.fetch_add(1, std::memory_order_relaxed);
+            c.total_ns.fetch_add(ns, std::memory_order_relaxed);
+            c.buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // One line per command that has run: count, errors, mean and p50 / p99 latency
+        void print(OutputSink &out) const {
+            out << "command              count     errors   mean (us)  p50 (us)  p99 (us)" << '\n';
+            for(size_t i = 0; i < COMMAND_COUNT; ++i){
+                const Counters &c = per_command[i];
+                uint64_t n = c.count.load(std::memory_order_relaxed);
+                if(n == 0) continue;
+                std::string name = label(i);
+                name.resize(std::max<size_t>(name.size(), 16), ' ');
+                char line[128];
+                std::snprintf(line, sizeof(line), "%s %10llu %10llu %11.1f %9llu %9llu\n", name.c_str(), (unsigned long long)n,
+                              (unsigned long long)c.errors.load(std::memory_order_relaxed),
+                              c.total_ns.load(std::memory_order_relaxed) / 1000.0 / n,
+                              (unsigned long long)quantile_us(c, 0.5), (unsigned long long)quantile_us(c, 0.99));
+                out << line;
+            }
+        }
+
+        // The same counters in Prometheus text exposition format
+        void print_prometheus(OutputSink &out) const {
+            out << "# HELP vcs_commands_total Commands run, by command.\n# TYPE vcs_commands_total counter\n";
+            for(size_t i = 0; i < COMMAND_COUNT; ++i){
+                out << "vcs_commands_total{command=\"" << label(i) << "\"} " << per_command[i].count.load(std::memory_order_relaxed) << '\n';
+            }
+            out << "# HELP vcs_command_errors_total Commands that failed, by command.\n# TYPE vcs_command_errors_total counter\n";
+            for(size_t i = 0; i < COMMAND_COUNT; ++i){
+                out << "vcs_command_errors_total{command=\"" << label(i) << "\"} " << per_command[i].errors.load(std::memory_order_relaxed) << '\n';
+            }
+            out << "# HELP vcs_command_duration_seconds Command latency, lock waits included.\n# TYPE vcs_command_duration_seconds histogram\n";
+            for(size_t i = 0; i < COMMAND_COUNT; ++i){
+                const Counters &c = per_command[i];
+                uint64_t n = c.count.load(std::memory_order_relaxed);
+                if(n == 0) continue;
+                uint64_t cumulative = 0;
+                char le[32];
+                for(int b = 0; b + 1 < BUCKETS; ++b){
+                    cumulative += c.buckets[b].load(std::memory_order_relaxed);
+                    std::snprintf(le, sizeof(le), "%g", bucket_bound_us(b) / 1e6);
+                    out << "vcs_command_duration_seconds_bucket{command=\"" << label(i) << "\",le=\"" << le << "\"} " << cumulative << '\n';
+                }
+                std::snprintf(le, sizeof(le), "%.9f", c.total_ns.load(std::memory_order_relaxed) / 1e9);
+                out << "vcs_command_duration_seconds_bucket{command=\"" << label(i) << "\",le=\"+Inf\"} " << n << '\n'
+                    << "vcs_command_duration_seconds_sum{command=\"" << label(i) << "\"} " << le << '\n'
+                    << "vcs_command_duration_seconds_count{command=\"" << label(i) << "\"} " << n << '\n';
+            }
+        }
+};
+
+// Counters of every command run in this process
+inline CommandMetrics command_metrics;
+
+#if VCS_METRICS
+// Times one command from construction to destruction; a command that ends by throwing counts as failed
+class CommandTimer
+{
+    private:
+        Command cmd;
+        int exceptions;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        explicit CommandTimer(Command c) : cmd(c), exceptions(std::uncaught_exceptions()), start(std::chrono::steady_clock::now()) {}
+        ~CommandTimer(){
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            command_metrics.record(cmd, ns, std::uncaught_exceptions() > exceptions);
+        }
+};
+#else
+class CommandTimer
+{
+    public:
+        explicit CommandTimer(Command) {}
+};
+#endif
+
+#endif // METRICS_H
@@ -0,0 +1,100 @@
+//
+// NodeArena: append-only slab arena with stable addresses and 32-bit indices.
+//
+// Elements live in at most MAX_SEGMENTS contiguous segments whose sizes double
+// (16, 32, 64, ... elements by default; the first holds 2^BaseBits), so growing never moves existing elements, a
+// 32-bit index maps to its slot with one bit scan, and consecutive versions of
+// a file sit next to each other in memory. Everything is destroyed and freed in
+// bulk when the arena goes away. Since appending never touches existing
+// elements or their segment pointers, another thread may read elements that
+// were handed to it (with release/acquire ordering) while one thread appends.
+//
+
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+template <typename T, int BaseBits = 4>
+class NodeArena
+{
+    private:
+        static_assert(BaseBits >= 0 && BaseBits <= 20, "NodeArena: first segment size out of range");
+        static constexpr int BASE_BITS = BaseBits; // First segment holds 2^BASE_BITS elements
+        static constexpr int MAX_SEGMENTS = 33 - BASE_BITS; // 2^BASE_BITS * (2^MAX_SEGMENTS - 1) > 2^32 elements
+
+        T* segments[MAX_SEGMENTS] = {};
+        uint32_t count = 0;
+
+        // Segment holding index i, and the index of its first element
+        static int segment_of(uint32_t i){
+            uint64_t v = (uint64_t(i) >> BASE_BITS) + 1;
+#ifdef _MSC_VER
+            unsigned long bit;
+            if(_BitScanReverse(&bit, (unsigned long)(v >> 32))) return 32 + bit;
+            _BitScanReverse(&bit, (unsigned long)v);
+            return bit;
+#else
+            return 63 - __builtin_clzll(v);
+#endif
+        }
+        static uint64_t segment_start(int s){ return (uint64_t(1) << BASE_BITS) * ((uint64_t(1) << s) - 1); }
+        static uint64_t segment_size(int s){ return uint64_t(1) << (BASE_BITS + s); }
+
+    public:
+        static constexpr uint32_t NONE = UINT32_MAX; // "No element" index
+
+        NodeArena() {}
+        NodeArena(const NodeArena &) = delete;
+        NodeArena &operator=(const NodeArena &) = delete;
+        ~NodeArena(){ clear(); }
+
+        uint32_t size() const { return count; }
+
+        T &operator[](uint32_t i){
+            int s = segment_of(i);
+            return segments[s][i - segment_start(s)];
+        }
+        const T &operator[](uint32_t i) const {
+            int s = segment_of(i);
+            return segments[s][i - segment_start(s)];
+        }
+
+        // Construct a new element at index size() and return it
+        template <typename... Args>
+        T* emplace_back(Args&&... args){
+            int s = segment_of(count);
+            if(segments[s] == nullptr){
+                segments[s] = static_cast<T*>(::operator new(segment_size(s) * sizeof(T)));
+            }
+            T* slot = segments[s] + (count - segment_start(s));
+            new (slot) T(std::forward<Args>(args)...);
+            ++count;
+            return slot;
+        }
+
+        // Bytes of element storage currently allocated
+        size_t bytes_reserved() const {
+            size_t total = 0;
+            for(int s = 0; s < MAX_SEGMENTS && segments[s] != nullptr; ++s) total += segment_size(s) * sizeof(T);
+            return total;
+        }
+
+        // Destroy every element and release all segments
+        void clear(){
+            for(uint32_t i = 0; i < count; ++i) (*this)[i].~T();
+            for(int s = 0; s < MAX_SEGMENTS; ++s){
+                ::operator delete(segments[s]);
+                segments[s] = nullptr;
+            }
+            count = 0;
+        }
+};
+
+#endif // NODE_ARENA_H
@@ -0,0 +1,162 @@
+//
+// OutputSink: buffered writer to a file descriptor (stdout, stderr or a socket).
+//
+// Text accumulates in an in-memory buffer and is written out only when the
+// buffer passes its limit or flush() is called, so a batch replay issues a few
+// large write() calls instead of one flush per output line. A sink on a
+// negative descriptor discards everything.
+//
+// Large byte ranges owned elsewhere (version content) can be written by
+// reference with write_shared(): the sink keeps a reference to their owner
+// instead of copying them into the buffer, and a flush hands the buffered text
+// and those ranges to the kernel together with writev(), straight from where
+// they are stored (the blob store, or a mapped repository file).
+//
+
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+class OutputSink
+{
+    private:
+        // Ranges shorter than this are copied into the buffer rather than written by reference
+        static constexpr size_t SHARED_MIN = 4096;
+
+        // A range written by reference, to go out after the first at bytes of buf
+        struct SharedRange { size_t at; std::string_view bytes; };
+
+        int fd;
+        size_t limit;
+        std::string buf;
+        std::vector<SharedRange> shared;
+        std::vector<std::shared_ptr<const void>> owners; // Keep the shared ranges valid until flushed
+        size_t shared_bytes = 0;
+
+        static long raw_write(int fd, const char* p, size_t n){
+#ifdef _WIN32
+            return _write(fd, p, (unsigned)n);
+#else
+            return ::write(fd, p, n);
+#endif
+        }
+
+        bool write_all(const char* p, size_t n){
+            while(n > 0){
+                long w = raw_write(fd, p, n);
+                if(w < 0){
+                    if(errno == EINTR) continue;
+                    return false;
+                }
+                p += w;
+                n -= w;
+            }
+            return true;
+        }
+
+        // Write the buffer with the shared ranges spliced in at their positions
+        bool write_spliced(){
+#ifdef _WIN32
+            size_t from = 0;
+            for(const SharedRange &r : shared){
+                if(!write_all(buf.data() + from, r.at - from) || !write_all(r.bytes.data(), r.bytes.size())) return false;
+                from = r.at;
+            }
+            return write_all(buf.data() + from, buf.size() - from);
+#else
+            std::vector<iovec> iov;
+            iov.reserve(2 * shared.size() + 1);
+            size_t from = 0;
+            auto add = [&](const char* p, size_t n){ if(n != 0) iov.push_back(iovec{const_cast<char*>(p), n}); };
+            for(const SharedRange &r : shared){
+                add(buf.data() + from, r.at - from);
+                add(r.bytes.data(), r.bytes.size());
+                from = r.at;
+            }
+            add(buf.data() + from, buf.size() - from);
+            for(size_t i = 0; i < iov.size(); ){
+                int count = (int)std::min<size_t>(iov.size() - i, 1024); // IOV_MAX is at least 1024 on POSIX systems
+                long w = ::writev(fd, &iov[i], count);
+                if(w < 0){
+                    if(errno == EINTR) continue;
+                    return false;
+                }
+                // Skip what was written, resuming inside a partly written range
+                while(i < iov.size() && (size_t)w >= iov[i].iov_len){ w -= iov[i].iov_len; ++i; }
+                if(w > 0){
+                    iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + w;
+                    iov[i].iov_len -= w;
+                }
+            }
+            return true;
+#endif
+        }
+
+    public:
+        explicit OutputSink(int out_fd, size_t buffer_limit = 1 << 16) : fd(out_fd), limit(buffer_limit) {
+            buf.reserve(buffer_limit < (1 << 20) ? buffer_limit : (1 << 20));
+        }
+        OutputSink(const OutputSink &) = delete;
+        OutputSink &operator=(const OutputSink &) = delete;
+        ~OutputSink(){ flush(); }
+
+        int descriptor() const { return fd; }
+
+        // Bytes buffered (or held by reference) and not yet written
+        size_t pending() const { return buf.size() + shared_bytes; }
+
+        // Write everything buffered so far; returns false if the descriptor failed
+        bool flush(){
+            bool ok = fd < 0 || (shared.empty() ? write_all(buf.data(), buf.size()) : write_spliced());
+            buf.clear();
+            shared.clear();
+            owners.clear();
+            shared_bytes = 0;
+            return ok;
+        }
+
+        // Write bytes that owner keeps valid; large ranges are not copied (see above)
+        OutputSink &write_shared(std::string_view bytes, const std::shared_ptr<const void> &owner){
+            if(fd < 0) return *this;
+            if(bytes.size() < SHARED_MIN) return write(bytes.data(), bytes.size());
+            shared.push_back(SharedRange{buf.size(), bytes});
+            if(owners.empty() || owners.back() != owner) owners.push_back(owner);
+            shared_bytes += bytes.size();
+            if(pending() >= limit) flush();
+            return *this;
+        }
+
+        OutputSink &write(const char* p, size_t n){
+            buf.append(p, n);
+            if(pending() >= limit) flush();
+            return *this;
+        }
+
+        OutputSink &operator<<(std::string_view s){ return write(s.data(), s.size()); }
+        OutputSink &operator<<(const char* s){ return *this << std::string_view(s); }
+        OutputSink &operator<<(const std::string &s){ return write(s.data(), s.size()); }
+        OutputSink &operator<<(char c){ return write(&c, 1); }
+
+        template <typename Int, typename = typename std::enable_if<std::is_integral<Int>::value>::type>
+        OutputSink &operator<<(Int v){
+            char tmp[24];
+            auto r = std::to_chars(tmp, tmp + sizeof(tmp), v);
+            return write(tmp, r.ptr - tmp);
+        }
+};
+
+#endif // OUTPUT_SINK_H
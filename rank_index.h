@@ -0,0 +1,62 @@
+//
+// RankIndex: ordered index of files by a numeric key (largest first).
+//
+// Backed by a balanced search tree (std::set) of (key, seq, File*) entries.
+// Files re-key themselves in O(log N) whenever the key changes, and a "top k"
+// query walks the first k entries in O(log N + k) without touching the rest of
+// the file set. Equal keys are ordered by seq (file creation order). Item is
+// the file type (File unless a BasicFile of another policy keeps rankings).
+//
+
+#ifndef RANK_INDEX_H
+#define RANK_INDEX_H
+
+#include <cstdint>
+#include <set>
+#include "storage_policy.h"
+
+template <typename Key, typename Item = File>
+class RankIndex
+{
+    private:
+        struct Entry {
+            Key key;
+            uint64_t seq;
+            Item* file;
+            bool operator<(const Entry &o) const {
+                if(key != o.key) return key > o.key;
+                return seq < o.seq;
+            }
+        };
+        std::set<Entry> entries;
+
+    public:
+        size_t size() const { return entries.size(); }
+
+        // Start tracking a file under its initial key
+        void add(Item* f, uint64_t seq, Key key){ entries.insert(Entry{key, seq, f}); }
+
+        // Stop tracking a file currently stored under key
+        void remove(Item* f, uint64_t seq, Key key){ entries.erase(Entry{key, seq, f}); }
+
+        // Move a file from old_key to new_key
+        void rekey(Item* f, uint64_t seq, Key old_key, Key new_key){
+            if(old_key == new_key) return;
+            auto it = entries.find(Entry{old_key, seq, f});
+            if(it == entries.end()) return;
+            // Reuse the tree node instead of freeing and reallocating it
+            auto nh = entries.extract(it);
+            nh.value().key = new_key;
+            entries.insert(std::move(nh));
+        }
+
+        // Visit the k largest entries in order as fn(Item*, key)
+        template <typename Fn>
+        void top(size_t k, Fn fn) const {
+            for(auto it = entries.begin(); it != entries.end() && k > 0; ++it, --k){
+                fn(it->file, it->key);
+            }
+        }
+};
+
+#endif // RANK_INDEX_H
@@ -0,0 +1,83 @@
+//
+// RefTable: the named refs (branches and tags) of one file.
+//
+// Refs are kept in one vector in creation order (the order REFS lists them),
+// and found by name through a small open-addressing index of 32-bit positions
+// into that vector, so looking up a branch head is O(1) and a file with no
+// refs costs two empty vectors. Refs are never removed.
+//
+// A tag names a fixed version. A branch names a version that moves: while the
+// branch is checked out, it follows the file's active version (see File).
+//
+
+#ifndef REF_TABLE_H
+#define REF_TABLE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "fast_hash.h"
+
+enum class RefKind : uint32_t { BRANCH = 0, TAG = 1 };
+
+struct Ref
+{
+    std::string name;
+    uint32_t target; // Version id
+    RefKind kind;
+};
+
+class RefTable
+{
+    private:
+        static constexpr uint32_t EMPTY = UINT32_MAX;
+
+        std::vector<Ref> refs;
+        std::vector<uint32_t> slots; // Position in refs, or EMPTY; size is a power of two
+
+        size_t home(std::string_view name) const { return fast_hash64(name) & (slots.size() - 1); }
+
+        void rehash(size_t cap){
+            slots.assign(cap, EMPTY);
+            for(uint32_t k = 0; k < refs.size(); ++k){
+                size_t i = home(refs[k].name);
+                while(slots[i] != EMPTY) i = (i + 1) & (slots.size() - 1);
+                slots[i] = k;
+            }
+        }
+
+    public:
+        static constexpr uint32_t npos = UINT32_MAX;
+
+        size_t size() const { return refs.size(); }
+        bool empty() const { return refs.empty(); }
+        const Ref &operator[](uint32_t i) const { return refs[i]; }
+        void retarget(uint32_t i, uint32_t target){ refs[i].target = target; }
+
+        std::vector<Ref>::const_iterator begin() const { return refs.begin(); }
+        std::vector<Ref>::const_iterator end() const { return refs.end(); }
+
+        // Position of the ref called name, or npos
+        uint32_t find(std::string_view name) const {
+            if(slots.empty()) return npos;
+            for(size_t i = home(name); slots[i] != EMPTY; i = (i + 1) & (slots.size() - 1)){
+                if(refs[slots[i]].name == name) return slots[i];
+            }
+            return npos;
+        }
+
+        // Add a ref (the name must not be taken); returns its position
+        uint32_t add(std::string_view name, RefKind kind, uint32_t target){
+            refs.push_back(Ref{std::string(name), target, kind});
+            if(refs.size() * 2 > slots.size()) rehash(slots.empty() ? 8 : slots.size() * 2);
+            else{
+                size_t i = home(name);
+                while(slots[i] != EMPTY) i = (i + 1) & (slots.size() - 1);
+                slots[i] = refs.size() - 1;
+            }
+            return refs.size() - 1;
+        }
+};
+
+#endif // REF_TABLE_H
@@ -0,0 +1,362 @@
+//
+// Replication: a primary streams its changes to read replicas.
+//
+// A primary started with --replicate=<address> hands every change it logs (the
+// record it appends to the write-ahead log, the command line of a successful
+// CREATE / INSERT / UPDATE / SNAPSHOT / ROLLBACK / ...) to a ReplicationHub
+// too. A replica started with --replica-of=<address> connects to it and is
+// sent, in order:
+//     snapshot  "VCSREPL1" | uint64 seq | uint64 size | repository file (repo_format.h)
+//     batches   uint32 records | uint32 bytes | uint64 primary_seq | records
+// The snapshot is the primary's state after change seq, written while no
+// change can run, so the batches carry every change after it: records encoded
+// as in the WAL (wal.h, CRC-checked) and numbered seq + 1, seq + 2, ... with no
+// gaps. Changes are batched like WAL groups: a batch goes out once
+// batch_records are pending, or batch_ms after the first of them. primary_seq
+// is the last change the primary had made when the batch was cut; an empty
+// batch is sent every second the primary is idle, as a heartbeat.
+//
+// Every replica has its own queue and sender thread, so a slow replica holds
+// up nobody else; one whose queue grows past max_pending bytes is disconnected.
+//
+// ReplicaLink is the replica's end: it receives the snapshot, then applies the
+// records of each batch in order and tracks how far behind it is: the changes
+// the primary has announced but not sent yet, and the lag of the last change
+// applied (from being made on the primary to being applied here; timestamps
+// are wall-clock based, clock.h, so between hosts this includes the
+// difference of their clocks).
+//
+// Thread safety: all methods may be called from any thread.
+//
+
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "clock.h"
+#include "server_socket.h"
+#include "wal.h"
+
+static const char REPLICATION_MAGIC[8] = {'V', 'C', 'S', 'R', 'E', 'P', 'L', '1'};
+static const size_t REPLICATION_SNAPSHOT_HEADER = 24;
+static const size_t REPLICATION_BATCH_HEADER = 16;
+
+// Primary side: queues changes for every connected replica and sends them in batches
+class ReplicationHub
+{
+    public:
+        struct Stats
+        {
+            uint64_t replicas = 0; // Connected
+            uint64_t last_seq = 0; // Last change published
+            uint64_t batches = 0;  // Sent, to all replicas together
+            uint64_t records = 0;
+            uint64_t bytes = 0;
+            uint64_t dropped = 0;  // Replicas disconnected (send failed, or too far behind)
+        };
+
+    private:
+        static constexpr std::chrono::seconds HEARTBEAT{1};
+
+        struct Replica
+        {
+            int fd;
+            std::string snapshot;  // Repository file sent first (deleted once sent)
+            uint64_t snapshot_seq; // Last change it includes
+            std::string pending;   // Encoded records not yet sent
+            uint32_t pending_records = 0;
+            bool closed = false;   // Sending stopped (or is to stop)
+            bool done = false;     // Sender finished; fd may be closed
+            std::condition_variable cv;
+            std::thread sender;
+        };
+
+        size_t batch_records;
+        std::chrono::milliseconds batch_interval;
+        size_t max_pending;
+
+        std::mutex m; // Protects everything below
+        std::vector<std::unique_ptr<Replica>> replicas;
+        uint64_t next_seq = 1;
+        Stats counters;
+        bool stopping = false;
+
+        static void put32(char* p, uint32_t v){ std::memcpy(p, &v, 4); }
+        static void put64(char* p, uint64_t v){ std::memcpy(p, &v, 8); }
+
+        bool send_snapshot(Replica &r){
+            std::error_code ec;
+            uint64_t size = std::filesystem::file_size(r.snapshot, ec);
+            FILE* f = ec ? nullptr : std::fopen(r.snapshot.c_str(), "rb");
+            if(f == nullptr) return false;
+            char hdr[REPLICATION_SNAPSHOT_HEADER];
+            std::memcpy(hdr, REPLICATION_MAGIC, 8);
+            put64(hdr + 8, r.snapshot_seq);
+            put64(hdr + 16, size);
+            bool ok = ServerSocket::send_all(r.fd, hdr, sizeof(hdr));
+            std::vector<char> chunk(1 << 16);
+            uint64_t sent = 0;
+            size_t n;
+            while(ok && (n = std::fread(chunk.data(), 1, chunk.size(), f)) > 0){
+                ok = ServerSocket::send_all(r.fd, chunk.data(), n);
+                sent += n;
+            }
+            std::fclose(f);
+            return ok && sent == size;
+        }
+
+        void send_loop(Replica* r){
+            bool ok = send_snapshot(*r);
+            std::remove(r->snapshot.c_str());
+            std::unique_lock<std::mutex> lk(m);
+            while(ok && !stopping && !r->closed){
+                if(r->pending_records == 0) r->cv.wait_for(lk, HEARTBEAT, [&]{ return stopping || r->closed || r->pending_records > 0; });
+                // Give more records a chance to join this batch
+                if(r->pending_records > 0 && r->pending_records < batch_records){
+                    r->cv.wait_for(lk, batch_interval, [&]{ return stopping || r->closed || r->pending_records >= batch_records; });
+                }
+                if(stopping || r->closed) break;
+                std::string batch;
+                batch.swap(r->pending);
+                uint32_t records = r->pending_records;
+                r->pending_records = 0;
+                char hdr[REPLICATION_BATCH_HEADER];
+                put32(hdr, records);
+                put32(hdr + 4, (uint32_t)batch.size());
+                put64(hdr + 8, next_seq - 1);
+                lk.unlock();
+                ok = ServerSocket::send_all(r->fd, hdr, sizeof(hdr)) && ServerSocket::send_all(r->fd, batch.data(), batch.size());
+                lk.lock();
+                if(ok){
+                    ++counters.batches;
+                    counters.records += records;
+                    counters.bytes += sizeof(hdr) + batch.size();
+                }
+            }
+            if(!stopping) ++counters.dropped;
+            r->closed = true;
+            r->pending.clear();
+            r->done = true;
+        }
+
+        // Join and forget replicas whose sender has finished (lock held)
+        void reap(){
+            auto gone = std::remove_if(replicas.begin(), replicas.end(), [](const std::unique_ptr<Replica> &r){
+                if(!r->done) return false;
+                r->sender.join();
+                ServerSocket::close_client(r->fd);
+                return true;
+            });
+            replicas.erase(gone, replicas.end());
+        }
+
+    public:
+        // Changes are sent once group_records are pending or group_ms after the first; a replica
+        // more than max_bytes of changes behind is disconnected
+        explicit ReplicationHub(size_t group_records = 64, unsigned group_ms = 10, size_t max_bytes = size_t(64) << 20)
+            : batch_records(group_records ? group_records : 1), batch_interval(group_ms), max_pending(max_bytes) {}
+        ReplicationHub(const ReplicationHub &) = delete;
+        ReplicationHub &operator=(const ReplicationHub &) = delete;
+        ~ReplicationHub(){
+            std::unique_lock<std::mutex> lk(m);
+            stopping = true;
+            for(auto &r : replicas){
+                if(r->done) continue;
+                ServerSocket::shutdown_client(r->fd); // Unblocks a send in progress
+                r->cv.notify_all();
+            }
+            lk.unlock();
+            for(auto &r : replicas){
+                r->sender.join();
+                ServerSocket::close_client(r->fd);
+            }
+        }
+
+        // Start replicating to the connected descriptor fd (owned by the hub from now on), sending
+        // the repository file at snapshot first. Must be called while no change can be published,
+        // with snapshot written since the last one.
+        void add(int fd, const std::string &snapshot){
+            std::lock_guard<std::mutex> lk(m);
+            if(stopping){
+                std::remove(snapshot.c_str());
+                ServerSocket::close_client(fd);
+                return;
+            }
+            reap();
+            replicas.push_back(std::make_unique<Replica>());
+            Replica* r = replicas.back().get();
+            r->fd = fd;
+            r->snapshot = snapshot;
+            r->snapshot_seq = next_seq - 1;
+            r->sender = std::thread(&ReplicationHub::send_loop, this, r);
+        }
+
+        // Queue one change for every replica; returns its sequence number. Changes must be
+        // published in the order they were made (under the same locks as their WAL record).
+        uint64_t publish(std::string_view payload, int64_t ts){
+            std::lock_guard<std::mutex> lk(m);
+            uint64_t seq = next_seq++;
+            std::string record;
+            for(auto &r : replicas){
+                if(r->closed) continue;
+                if(record.empty()) WriteAheadLog::encode(record, seq, ts, payload);
+                r->pending += record;
+                ++r->pending_records;
+                if(r->pending.size() > max_pending){
+                    r->closed = true; // Too far behind: it has to start over from a new snapshot
+                    ServerSocket::shutdown_client(r->fd);
+                    r->cv.notify_one();
+                }
+                else if(r->pending_records == 1 || r->pending_records >= batch_records) r->cv.notify_one();
+            }
+            return seq;
+        }
+
+        Stats stats(){
+            std::lock_guard<std::mutex> lk(m);
+            Stats st = counters;
+            st.last_seq = next_seq - 1;
+            for(auto &r : replicas) st.replicas += r->closed ? 0 : 1;
+            return st;
+        }
+};
+
+// Replica side: one connection to a primary
+class ReplicaLink
+{
+    public:
+        struct Stats
+        {
+            bool connected = false;
+            uint64_t applied_seq = 0;   // Last change applied
+            uint64_t primary_seq = 0;   // Last change the primary has reported making
+            uint64_t batches = 0;
+            uint64_t records = 0;
+            uint64_t errors = 0;        // Changes that failed to apply
+            Timestamp lag = 0;          // Last change applied: time applied minus time made on the primary
+            Timestamp last_contact = 0; // When the last batch (or heartbeat) arrived
+        };
+
+    private:
+        int fd;
+        std::string address;
+
+        std::mutex m; // Protects st
+        Stats st;
+
+        [[noreturn]] void lost(const std::string &what){
+            std::lock_guard<std::mutex> lk(m);
+            st.connected = false;
+            throw std::runtime_error(what + ": " + address);
+        }
+
+    public:
+        explicit ReplicaLink(const std::string &primary) : fd(ServerSocket::connect_to(primary)), address(primary) {
+            st.connected = true;
+        }
+        ReplicaLink(const ReplicaLink &) = delete;
+        ReplicaLink &operator=(const ReplicaLink &) = delete;
+        ~ReplicaLink(){ ServerSocket::close_client(fd); }
+
+        const std::string &primary() const { return address; }
+
+        // Receive the primary's snapshot into the file at path; returns the last change it includes
+        uint64_t receive_snapshot(const std::string &path){
+            char hdr[REPLICATION_SNAPSHOT_HEADER];
+            if(!ServerSocket::receive_all(fd, hdr, sizeof(hdr)) || std::memcmp(hdr, REPLICATION_MAGIC, 8) != 0){
+                lost("Cannot receive snapshot from primary");
+            }
+            uint64_t seq, size;
+            std::memcpy(&seq, hdr + 8, 8);
+            std::memcpy(&size, hdr + 16, 8);
+            FILE* f = std::fopen(path.c_str(), "wb");
+            if(f == nullptr) throw std::runtime_error("Cannot write repository file: " + path);
+            std::vector<char> chunk(1 << 16);
+            bool ok = true;
+            while(ok && size > 0){
+                size_t n = (size_t)std::min<uint64_t>(size, chunk.size());
+                ok = ServerSocket::receive_all(fd, chunk.data(), n) && std::fwrite(chunk.data(), 1, n, f) == n;
+                size -= n;
+            }
+            ok = (std::fclose(f) == 0) && ok;
+            if(!ok){
+                std::remove(path.c_str());
+                lost("Cannot receive snapshot from primary");
+            }
+            std::lock_guard<std::mutex> lk(m);
+            st.applied_seq = st.primary_seq = seq;
+            st.last_contact = clock_now();
+            return seq;
+        }
+
+        // Apply the primary's changes until the connection ends (or stop() is called):
+        // apply(ts, payload) for each record in order, returning whether it succeeded.
+        // Throws if the stream is corrupt or out of sequence.
+        template <typename Fn>
+        void run(Fn apply){
+            std::string batch;
+            char hdr[REPLICATION_BATCH_HEADER];
+            while(ServerSocket::receive_all(fd, hdr, sizeof(hdr))){
+                uint32_t records, bytes;
+                uint64_t primary_seq;
+                std::memcpy(&records, hdr, 4);
+                std::memcpy(&bytes, hdr + 4, 4);
+                std::memcpy(&primary_seq, hdr + 8, 8);
+                batch.resize(bytes);
+                if(!ServerSocket::receive_all(fd, &batch[0], bytes)) break;
+                Timestamp arrived = clock_now();
+                uint64_t applied;
+                {
+                    std::lock_guard<std::mutex> lk(m);
+                    applied = st.applied_seq;
+                }
+                uint32_t count = 0, failed = 0;
+                Timestamp made = 0;
+                for(size_t pos = 0; pos < batch.size(); ++count){
+                    uint64_t seq;
+                    int64_t ts;
+                    std::string_view payload;
+                    size_t used = WriteAheadLog::decode(batch.data() + pos, batch.size() - pos, seq, ts, payload);
+                    if(used == 0 || seq != applied + 1) lost("Corrupt replication stream from primary");
+                    if(!apply(ts, payload)) ++failed;
+                    applied = seq;
+                    made = ts;
+                    pos += used;
+                }
+                if(count != records) lost("Corrupt replication stream from primary");
+                std::lock_guard<std::mutex> lk(m);
+                st.applied_seq = applied;
+                st.primary_seq = std::max(st.primary_seq, primary_seq);
+                ++st.batches;
+                st.records += count;
+                st.errors += failed;
+                if(count > 0) st.lag = clock_now() - made;
+                st.last_contact = arrived;
+            }
+            std::lock_guard<std::mutex> lk(m);
+            st.connected = false;
+        }
+
+        // Make run() return
+        void stop(){ ServerSocket::shutdown_client(fd); }
+
+        Stats stats(){
+            std::lock_guard<std::mutex> lk(m);
+            return st;
+        }
+};
+
+#endif // REPLICATION_H
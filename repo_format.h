@@ -0,0 +1,356 @@
+//
+// On-disk repository format used by SAVE / LOAD.
+//
+// Layout (all integers little-endian, every section 8-byte aligned):
+//
+//     RepoHeader
+//     RepoFileRecord[file_count]  one per file, in creation order
+//     RepoNodeRecord[node_count]  versions of every file; a file's versions are
+//                                 contiguous and ordered by version id
+//     RepoBlobRecord[blob_count]  (offset, size) of each distinct content blob
+//     RepoRefRecord[ref_count]    branches and tags; a file's refs are contiguous
+//                                 and in creation order
+//     string table                file names, snapshot messages and ref names
+//     blob data                   raw content bytes, each blob stored once
+//
+// The layout is designed to be used in place: RepoImage maps the file and hands
+// out pointers to its records and string_views into its string and blob
+// sections, so a loaded file can be READ or listed without deserializing it.
+// Timestamps (int64) are nanoseconds since the Unix epoch; see clock.h.
+//
+
+#ifndef REPO_FORMAT_H
+#define REPO_FORMAT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+static const char REPO_MAGIC[8] = {'V', 'C', 'S', 'R', 'E', 'P', 'O', '1'};
+static const uint32_t REPO_FORMAT_VERSION = 8;
+static const uint32_t REPO_NO_NODE = UINT32_MAX;
+static const uint32_t REPO_NO_REF = UINT32_MAX;
+static const uint32_t REPO_NODE_PRUNED = 1; // RepoNodeRecord::flags: content and message dropped by GC / PRUNE
+static const uint32_t REPO_NODE_COMPRESSED = 2; // RepoNodeRecord::flags: the blob holds the version's bytes LZ-compressed
+
+struct RepoHeader
+{
+    char magic[8];
+    uint32_t format_version;
+    uint32_t hash_mode;       // HashMode the blobs were identified with
+    uint64_t file_count;
+    uint64_t node_count;
+    uint64_t blob_count;
+    uint64_t files_offset;
+    uint64_t nodes_offset;
+    uint64_t blobs_offset;    // RepoBlobRecord table
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t data_offset;     // Blob bytes
+    uint64_t data_size;
+    uint64_t wal_seq;         // Last write-ahead log record included in this state (0 if none)
+    uint64_t ref_count;
+    uint64_t refs_offset;
+};
+
+struct RepoFileRecord
+{
+    uint64_t name_offset;     // In the string table
+    uint32_t name_length;
+    uint32_t node_count;      // Number of versions
+    uint64_t first_node;      // Index of version 0 in the node table
+    uint64_t seq;             // Creation order
+    int64_t last_modification;
+    uint32_t active_version;
+    uint32_t ref_count;       // Number of refs
+    uint64_t first_ref;       // Index of the file's first ref in the ref table
+    uint32_t current_ref;     // Checked-out branch, as an index among the file's refs (REPO_NO_REF if none)
+    uint32_t reserved;
+};
+
+struct RepoNodeRecord
+{
+    uint32_t parent;          // Version id within the file (REPO_NO_NODE for the root)
+    int32_t delta_depth;
+    uint32_t depth;           // Number of ancestors (0 for the root)
+    uint32_t jump;            // Jump pointer ancestor (0 for the root)
+    uint32_t flags;           // REPO_NODE_PRUNED, REPO_NODE_COMPRESSED
+    uint32_t kept_parent;     // Nearest ancestor that is not pruned (REPO_NO_NODE if none)
+    uint64_t base_len;
+    uint64_t length;
+    uint64_t blob;            // Index in the blob table
+    int64_t created_ts;
+    int64_t snapshot_ts;
+    uint64_t message_offset;  // In the string table
+    uint64_t message_length;
+};
+
+struct RepoBlobRecord
+{
+    uint64_t offset;          // In the blob data section
+    uint64_t size;
+};
+
+struct RepoRefRecord
+{
+    uint64_t name_offset;     // In the string table
+    uint32_t name_length;
+    uint32_t target;          // Version id within the file
+    uint32_t kind;            // RefKind: 0 = branch, 1 = tag
+    uint32_t reserved;
+};
+
+// Read-only view of a whole file: memory-mapped where available, read into memory otherwise
+class MappedFile
+{
+    private:
+        const char* ptr = nullptr;
+        size_t len = 0;
+        std::string fallback; // Used when mmap is not available
+
+    public:
+        explicit MappedFile(const std::string &path){
+#ifndef _WIN32
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0) throw std::runtime_error("Cannot open repository file: " + path);
+            struct stat st;
+            if(fstat(fd, &st) != 0){ ::close(fd); throw std::runtime_error("Cannot read repository file: " + path); }
+            len = st.st_size;
+            if(len > 0){
+                void* m = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(m == MAP_FAILED){ ::close(fd); throw std::runtime_error("Cannot map repository file: " + path); }
+                ptr = static_cast<const char*>(m);
+            }
+            ::close(fd);
+#else
+            FILE* f = std::fopen(path.c_str(), "rb");
+            if(f == nullptr) throw std::runtime_error("Cannot open repository file: " + path);
+            char chunk[1 << 16];
+            size_t n;
+            while((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0) fallback.append(chunk, n);
+            std::fclose(f);
+            ptr = fallback.data();
+            len = fallback.size();
+#endif
+        }
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        ~MappedFile(){
+#ifndef _WIN32
+            if(ptr != nullptr) munmap(const_cast<char*>(ptr), len);
+#endif
+        }
+
+        const char* data() const { return ptr; }
+        size_t size() const { return len; }
+};
+
+// A loaded repository file. Section bounds are checked when the image is
+// opened and record fields when they are used, so a corrupt file raises an
+// error instead of reading out of bounds.
+class RepoImage
+{
+    private:
+        MappedFile map;
+        RepoHeader hdr;
+
+        [[noreturn]] static void corrupt(){ throw std::runtime_error("Invalid repository file"); }
+
+        void check_section(uint64_t offset, uint64_t count, uint64_t elem) const {
+            if(offset % 8 != 0 || offset > map.size() || (elem != 0 && count > (map.size() - offset) / elem)) corrupt();
+        }
+
+    public:
+        explicit RepoImage(const std::string &path) : map(path) {
+            if(map.size() < sizeof(RepoHeader)) corrupt();
+            std::memcpy(&hdr, map.data(), sizeof(hdr));
+            if(std::memcmp(hdr.magic, REPO_MAGIC, 8) != 0 || hdr.format_version != REPO_FORMAT_VERSION) corrupt();
+            check_section(hdr.files_offset, hdr.file_count, sizeof(RepoFileRecord));
+            check_section(hdr.nodes_offset, hdr.node_count, sizeof(RepoNodeRecord));
+            check_section(hdr.blobs_offset, hdr.blob_count, sizeof(RepoBlobRecord));
+            check_section(hdr.refs_offset, hdr.ref_count, sizeof(RepoRefRecord));
+            check_section(hdr.strings_offset, hdr.strings_size, 1);
+            check_section(hdr.data_offset, hdr.data_size, 1);
+        }
+
+        const RepoHeader &header() const { return hdr; }
+        uint64_t file_count() const { return hdr.file_count; }
+
+        const RepoFileRecord &file(uint64_t i) const {
+            if(i >= hdr.file_count) corrupt();
+            const RepoFileRecord &f = reinterpret_cast<const RepoFileRecord*>(map.data() + hdr.files_offset)[i];
+            if(f.node_count == 0 || f.first_node > hdr.node_count || f.node_count > hdr.node_count - f.first_node
+               || f.active_version >= f.node_count) corrupt();
+            if(f.first_ref > hdr.ref_count || f.ref_count > hdr.ref_count - f.first_ref
+               || (f.current_ref != REPO_NO_REF && f.current_ref >= f.ref_count)) corrupt();
+            return f;
+        }
+
+        // i'th ref of file f, checked against the file's ref and node ranges
+        const RepoRefRecord &ref(const RepoFileRecord &f, uint32_t i) const {
+            if(i >= f.ref_count) corrupt();
+            const RepoRefRecord &r = reinterpret_cast<const RepoRefRecord*>(map.data() + hdr.refs_offset)[f.first_ref + i];
+            if(r.target >= f.node_count || r.kind > 1) corrupt();
+            return r;
+        }
+
+        // Record of version id of file f, checked against the file's node range
+        const RepoNodeRecord &node(const RepoFileRecord &f, uint32_t id) const {
+            if(id >= f.node_count) corrupt();
+            const RepoNodeRecord &n = reinterpret_cast<const RepoNodeRecord*>(map.data() + hdr.nodes_offset)[f.first_node + id];
+            if(n.parent != REPO_NO_NODE && n.parent >= id) corrupt();
+            if(n.base_len != 0 && n.parent == REPO_NO_NODE) corrupt();
+            // Depths must count ancestors exactly and jumps point strictly upwards,
+            // so ancestor walks always terminate
+            if(n.parent == REPO_NO_NODE ? n.depth != 0 || n.jump != 0 : n.jump >= id) corrupt();
+            if(n.kept_parent != REPO_NO_NODE && (n.parent == REPO_NO_NODE || n.kept_parent > n.parent)) corrupt();
+            if(n.parent != REPO_NO_NODE){
+                const RepoNodeRecord &p = reinterpret_cast<const RepoNodeRecord*>(map.data() + hdr.nodes_offset)[f.first_node + n.parent];
+                if(n.depth != p.depth + 1) corrupt();
+                // A delta needs its base's bytes
+                if(n.base_len != 0 && (p.flags & REPO_NODE_PRUNED)) corrupt();
+            }
+            if((n.flags & REPO_NODE_PRUNED) && (n.base_len != 0 || n.length != 0)) corrupt();
+            if((n.flags & REPO_NODE_COMPRESSED) && ((n.flags & REPO_NODE_PRUNED) || n.base_len > n.length)) corrupt();
+            return n;
+        }
+
+        std::string_view str(uint64_t offset, uint64_t length) const {
+            if(offset > hdr.strings_size || length > hdr.strings_size - offset) corrupt();
+            return std::string_view(map.data() + hdr.strings_offset + offset, length);
+        }
+
+        std::string_view blob(uint64_t i) const {
+            if(i >= hdr.blob_count) corrupt();
+            const RepoBlobRecord &b = reinterpret_cast<const RepoBlobRecord*>(map.data() + hdr.blobs_offset)[i];
+            if(b.offset > hdr.data_size || b.size > hdr.data_size - b.offset) corrupt();
+            return std::string_view(map.data() + hdr.data_offset + b.offset, b.size);
+        }
+
+        std::string_view name(const RepoFileRecord &f) const { return str(f.name_offset, f.name_length); }
+        std::string_view message(const RepoNodeRecord &n) const { return str(n.message_offset, n.message_length); }
+        std::string_view name(const RepoRefRecord &r) const { return str(r.name_offset, r.name_length); }
+};
+
+// Accumulates records for SAVE and writes them out as one repository file
+class RepoWriter
+{
+    private:
+        std::vector<RepoFileRecord> files;
+        std::vector<RepoNodeRecord> nodes;
+        std::vector<RepoBlobRecord> blobs;
+        std::vector<RepoRefRecord> refs;
+        std::string strings;
+        std::string data;
+
+        static uint64_t align8(uint64_t v){ return (v + 7) & ~uint64_t(7); }
+
+    public:
+        uint64_t add_string(std::string_view s){
+            uint64_t off = strings.size();
+            strings.append(s.data(), s.size());
+            return off;
+        }
+
+        uint64_t add_blob(std::string_view bytes){
+            blobs.push_back(RepoBlobRecord{data.size(), bytes.size()});
+            data.append(bytes.data(), bytes.size());
+            return blobs.size() - 1;
+        }
+
+        uint64_t node_count() const { return nodes.size(); }
+        void add_node(const RepoNodeRecord &n){ nodes.push_back(n); }
+        void add_file(const RepoFileRecord &f){ files.push_back(f); }
+        uint64_t ref_count() const { return refs.size(); }
+        void add_ref(const RepoRefRecord &r){ refs.push_back(r); }
+
+        // fsync the directory holding path, so a rename into it survives a power loss
+        static bool sync_parent(const std::string &path){
+#ifdef _WIN32
+            (void)path; // NTFS journals the rename itself; directories cannot be flushed
+            return true;
+#else
+            size_t slash = path.find_last_of('/');
+            std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+            int d = ::open(dir.c_str(), O_RDONLY);
+            if(d < 0) return false;
+            bool ok = fsync(d) == 0;
+            ::close(d);
+            return ok;
+#endif
+        }
+
+        // Write to path via a temporary file, so a failed SAVE never leaves a truncated repository.
+        // The file and the rename are fsync'ed before returning: a checkpoint must be durable
+        // before the write-ahead log it replaces is emptied.
+        void write(const std::string &path, uint32_t hash_mode, uint64_t wal_seq = 0) const {
+            RepoHeader h;
+            std::memset(&h, 0, sizeof(h));
+            std::memcpy(h.magic, REPO_MAGIC, 8);
+            h.format_version = REPO_FORMAT_VERSION;
+            h.hash_mode = hash_mode;
+            h.file_count = files.size();
+            h.node_count = nodes.size();
+            h.blob_count = blobs.size();
+            h.files_offset = align8(sizeof(RepoHeader));
+            h.nodes_offset = align8(h.files_offset + files.size() * sizeof(RepoFileRecord));
+            h.blobs_offset = align8(h.nodes_offset + nodes.size() * sizeof(RepoNodeRecord));
+            h.ref_count = refs.size();
+            h.refs_offset = align8(h.blobs_offset + blobs.size() * sizeof(RepoBlobRecord));
+            h.strings_offset = align8(h.refs_offset + refs.size() * sizeof(RepoRefRecord));
+            h.strings_size = strings.size();
+            h.data_offset = align8(h.strings_offset + strings.size());
+            h.data_size = data.size();
+            h.wal_seq = wal_seq;
+
+            std::string tmp = path + ".tmp";
+            FILE* f = std::fopen(tmp.c_str(), "wb");
+            if(f == nullptr) throw std::runtime_error("Cannot write repository file: " + path);
+            uint64_t pos = 0;
+            bool ok = true;
+            auto put = [&](uint64_t offset, const void* p, size_t n){
+                static const char zeros[8] = {};
+                if(offset > pos) ok = ok && std::fwrite(zeros, 1, offset - pos, f) == offset - pos;
+                ok = ok && (n == 0 || std::fwrite(p, 1, n, f) == n);
+                pos = offset + n;
+            };
+            put(0, &h, sizeof(h));
+            put(h.files_offset, files.data(), files.size() * sizeof(RepoFileRecord));
+            put(h.nodes_offset, nodes.data(), nodes.size() * sizeof(RepoNodeRecord));
+            put(h.blobs_offset, blobs.data(), blobs.size() * sizeof(RepoBlobRecord));
+            put(h.refs_offset, refs.data(), refs.size() * sizeof(RepoRefRecord));
+            put(h.strings_offset, strings.data(), strings.size());
+            put(h.data_offset, data.data(), data.size());
+            ok = ok && std::fflush(f) == 0;
+#ifdef _WIN32
+            ok = ok && _commit(_fileno(f)) == 0;
+#else
+            ok = ok && fsync(fileno(f)) == 0;
+#endif
+            ok = (std::fclose(f) == 0) && ok;
+            if(!ok){ std::remove(tmp.c_str()); throw std::runtime_error("Cannot write repository file: " + path); }
+#ifdef _WIN32
+            std::remove(path.c_str()); // rename() does not replace existing files on Windows
+#endif
+            if(std::rename(tmp.c_str(), path.c_str()) != 0){
+                std::remove(tmp.c_str());
+                throw std::runtime_error("Cannot write repository file: " + path);
+            }
+            if(!sync_parent(path)) throw std::runtime_error("Cannot write repository file: " + path);
+        }
+};
+
+#endif // REPO_FORMAT_H
@@ -0,0 +1,166 @@
+//
+// Substring search for SEARCH: a trigram index of version bytes and a fast
+// verifying scan.
+//
+// TrigramIndex maps every 3-byte sequence (trigram) to the versions whose
+// indexed bytes contain it. The bytes indexed for a version are those past the
+// prefix it shares with its parent (recorded alongside), so a chain of versions
+// that mostly repeat each other costs little to index even when some of them
+// store their content in full. A string of three bytes or more can only occur in
+// bytes that hold every one of its trigrams, so intersecting their posting
+// lists narrows a search down to a few candidates, which find_bytes() then
+// checks exactly. The index only ever claims too much, never too little:
+// versions it has not seen (or has been told to forget) are always candidates.
+//
+// find_bytes() looks for the first and last byte of the pattern 16 positions
+// at a time with SSE2 compares (a plain search elsewhere) and compares the
+// rest only where both match.
+//
+
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SEARCH_HAVE_SSE2 1
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Position of the first occurrence of needle in hay, or npos
+inline size_t find_bytes(std::string_view hay, std::string_view needle){
+    size_t n = hay.size(), m = needle.size();
+    if(m == 0) return 0;
+    if(m > n) return std::string_view::npos;
+    size_t i = 0;
+#ifdef SEARCH_HAVE_SSE2
+    if(m > 1){
+        const char* s = hay.data();
+        const __m128i first = _mm_set1_epi8(needle[0]), last = _mm_set1_epi8(needle[m - 1]);
+        for(; i + m - 1 + 16 <= n; i += 16){
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + m - 1));
+            unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+            while(mask != 0){
+#ifdef _MSC_VER
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+#else
+                unsigned bit = __builtin_ctz(mask);
+#endif
+                if(std::memcmp(s + i + bit + 1, needle.data() + 1, m - 2) == 0) return i + bit;
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+    return hay.find(needle, i);
+}
+
+class TrigramIndex
+{
+    private:
+        struct Postings
+        {
+            std::vector<uint32_t> ids; // Versions whose indexed bytes hold the trigram
+            bool sorted = true; // ids is ascending without repeats
+        };
+        std::unordered_map<uint32_t, Postings> postings;
+        std::vector<char> indexed; // By version id: its bytes are in postings and still current
+        std::vector<size_t> shared; // By version id: length of the prefix it shares with its parent
+
+        // Distinct trigrams of the concatenated pieces, each as its 3 bytes in a 24-bit code
+        static std::vector<uint32_t> trigrams_of(const std::vector<std::string_view> &pieces){
+            // One bit per possible trigram; cleared again before returning
+            thread_local std::unique_ptr<uint64_t[]> seen(new uint64_t[(1 << 24) / 64]());
+            std::vector<uint32_t> grams;
+            uint32_t code = 0;
+            size_t bytes = 0;
+            for(std::string_view p : pieces){
+                for(char c : p){
+                    code = ((code << 8) | (unsigned char)c) & 0xFFFFFF;
+                    if(++bytes < 3) continue;
+                    uint64_t bit = uint64_t(1) << (code & 63);
+                    if(seen[code >> 6] & bit) continue;
+                    seen[code >> 6] |= bit;
+                    grams.push_back(code);
+                }
+            }
+            for(uint32_t g : grams) seen[g >> 6] = 0;
+            return grams;
+        }
+
+        // Make the posting list of a trigram ascending and repeat-free before it is intersected
+        static const std::vector<uint32_t> &ids_of(Postings &p){
+            if(!p.sorted){
+                std::sort(p.ids.begin(), p.ids.end());
+                p.ids.erase(std::unique(p.ids.begin(), p.ids.end()), p.ids.end());
+                p.sorted = true;
+            }
+            return p.ids;
+        }
+
+    public:
+        // Whether version id's bytes are indexed (and have not been forgotten since)
+        bool covers(uint32_t id) const { return id < indexed.size() && indexed[id]; }
+
+        // Length of the prefix an indexed version shares with its parent (base_len if not covered)
+        size_t shared_prefix(uint32_t id, size_t base_len) const { return covers(id) ? shared[id] : base_len; }
+
+        // Index the bytes of version id past the first prefix bytes of its content (the part it
+        // shares with its parent), given as the pieces they are made of
+        void add(uint32_t id, size_t prefix, const std::vector<std::string_view> &pieces){
+            for(uint32_t g : trigrams_of(pieces)){
+                Postings &p = postings[g];
+                if(!p.ids.empty() && id <= p.ids.back()) p.sorted = false;
+                p.ids.push_back(id);
+            }
+            if(indexed.size() <= id){
+                indexed.resize(id + 1, 0);
+                shared.resize(id + 1, 0);
+            }
+            indexed[id] = 1;
+            shared[id] = prefix;
+        }
+
+        // Stop trusting the index for version id (its bytes changed); add() it again to re-index
+        void forget(uint32_t id){ if(id < indexed.size()) indexed[id] = 0; }
+
+        // For every version id below versions: 1 if its bytes may contain pattern (it is not
+        // covered, the pattern is shorter than a trigram, or its bytes hold all the pattern's
+        // trigrams), 0 if they cannot
+        std::vector<char> candidates(std::string_view pattern, uint32_t versions){
+            std::vector<char> maybe(versions, 0);
+            for(uint32_t id = 0; id < versions; ++id) maybe[id] = !covers(id);
+            if(pattern.size() < 3){
+                std::fill(maybe.begin(), maybe.end(), 1);
+                return maybe;
+            }
+            std::vector<const std::vector<uint32_t>*> lists;
+            for(uint32_t g : trigrams_of({pattern})){
+                auto it = postings.find(g);
+                if(it == postings.end()) return maybe; // No indexed version holds this trigram
+                lists.push_back(&ids_of(it->second));
+            }
+            std::sort(lists.begin(), lists.end(), [](const std::vector<uint32_t>* a, const std::vector<uint32_t>* b) { return a->size() < b->size(); });
+            std::vector<uint32_t> common = *lists[0], next;
+            for(size_t k = 1; k < lists.size() && !common.empty(); ++k){
+                next.clear();
+                std::set_intersection(common.begin(), common.end(), lists[k]->begin(), lists[k]->end(), std::back_inserter(next));
+                common.swap(next);
+            }
+            for(uint32_t id : common) if(id < versions) maybe[id] = 1;
+            return maybe;
+        }
+};
+
+#endif // SEARCH_INDEX_H
@@ -0,0 +1,333 @@
+//
+// SegmentStore: log-structured on-disk storage for the bytes of cold versions.
+//
+// With --store, the cold sweep (File::compress_cold()) moves the stored bytes
+// of cold versions out of memory: each is appended to the current segment file
+// in the store's directory as one record
+//     uint64 key | uint64 length | bytes
+// and the version keeps only the key. An in-memory index maps every key to the
+// segment and offset of its record, and reads page the bytes back in with a
+// positional read (through cold_cache, so a version that keeps being read is
+// read from disk once). Records are buffered and written a block at a time;
+// segments are closed once they reach segment_bytes and never written again.
+//
+// Releasing a key (GC / PRUNE dropped the version, or its bytes were rewritten)
+// only marks its record dead. A background thread compacts every closed segment
+// that is at least half dead (closing the current one early if it is): the
+// records still live are appended to the current segment and the old file is
+// deleted, so segments holding mostly dropped versions are merged into new
+// ones. Readers of a record that is moved meanwhile keep the old file open
+// until they are done.
+//
+// The segments are a spill area, not a copy of the repository: durability
+// stays with SAVE and the write-ahead log, and segment files left over from an
+// earlier run are deleted when a store is opened.
+//
+// Thread safety: all methods may be called from any thread.
+//
+
+#ifndef SEGMENT_STORE_H
+#define SEGMENT_STORE_H
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+class SegmentStore
+{
+    public:
+        struct Stats
+        {
+            uint64_t segments = 0;
+            uint64_t records = 0;     // Live records
+            uint64_t disk_bytes = 0;  // Size of all segment files
+            uint64_t live_bytes = 0;  // Bytes of live records (headers included)
+            uint64_t compactions = 0; // Segments compacted away so far
+            uint64_t pending_bytes = 0; // Appended bytes still buffered in memory
+        };
+
+    private:
+        static constexpr size_t HEADER_SIZE = 16;
+        static constexpr size_t WRITE_BLOCK = size_t(1) << 20; // Buffered bytes that trigger a write
+
+        struct Segment
+        {
+            uint32_t id;
+            int fd;
+            std::string path;
+            uint64_t size = 0; // Bytes in the file, buffered ones included
+            uint64_t live = 0; // Bytes of records still in the index
+#ifdef _WIN32
+            std::mutex seek; // Positional reads are a seek and a read
+#endif
+            Segment(uint32_t n, int f, std::string p) : id(n), fd(f), path(std::move(p)) {}
+            ~Segment(){
+#ifdef _WIN32
+                _close(fd);
+#else
+                ::close(fd);
+#endif
+            }
+        };
+
+        struct Location
+        {
+            uint32_t segment;
+            uint64_t offset; // Of the record's bytes (past its header)
+            uint64_t length;
+        };
+
+        std::string dir;
+        uint64_t segment_bytes;
+
+        std::mutex m; // Protects everything below
+        std::condition_variable cv;
+        std::unordered_map<uint64_t, Location> index;
+        std::map<uint32_t, std::shared_ptr<Segment>> segments; // By id; the last one is written to
+        std::shared_ptr<Segment> active;
+        std::string pending;    // Tail of the active segment not written yet
+        uint64_t pending_at = 0; // Offset of pending in the active segment
+        uint32_t next_segment = 0;
+        uint64_t next_key = 1;
+        uint64_t compactions = 0;
+        bool due = false; // A closed segment is at least half dead
+        bool stopping = false;
+        bool failed = false;
+        std::thread compactor;
+
+        std::string segment_path(uint32_t id) const {
+            char name[32];
+            std::snprintf(name, sizeof(name), "segment-%08u.seg", id);
+            return (std::filesystem::path(dir) / name).string();
+        }
+
+        static bool write_all(int f, const char* p, size_t n){
+            while(n > 0){
+#ifdef _WIN32
+                long w = _write(f, p, (unsigned)n);
+#else
+                long w = ::write(f, p, n);
+#endif
+                if(w < 0){ if(errno == EINTR) continue; return false; }
+                p += w; n -= w;
+            }
+            return true;
+        }
+
+        static bool read_at(Segment &s, char* p, size_t n, uint64_t offset){
+#ifdef _WIN32
+            std::lock_guard<std::mutex> lk(s.seek);
+            if(_lseeki64(s.fd, (long long)offset, SEEK_SET) < 0) return false;
+#endif
+            while(n > 0){
+#ifdef _WIN32
+                long r = _read(s.fd, p, (unsigned)n);
+#else
+                long r = ::pread(s.fd, p, n, (off_t)offset);
+#endif
+                if(r < 0 && errno == EINTR) continue;
+                if(r <= 0) return false;
+                p += r; n -= r; offset += r;
+            }
+            return true;
+        }
+
+        // Write out the buffered tail of the active segment (lock held)
+        void flush(){
+            if(pending.empty()) return;
+            if(!write_all(active->fd, pending.data(), pending.size())) failed = true;
+            pending_at += pending.size();
+            pending.clear();
+            if(failed) throw std::runtime_error("Cannot write segment file: " + active->path);
+        }
+
+        // Start a new active segment, closing the current one (lock held)
+        void roll(){
+            if(active != nullptr){
+                flush();
+                if(active->live * 2 <= active->size){ due = true; cv.notify_one(); }
+            }
+            uint32_t id = next_segment++;
+            std::string p = segment_path(id);
+#ifdef _WIN32
+            int f = _open(p.c_str(), _O_RDWR | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+            int f = ::open(p.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+#endif
+            if(f < 0) throw std::runtime_error("Cannot open segment file: " + p);
+            active = std::make_shared<Segment>(id, f, p);
+            segments.emplace(id, active);
+            pending_at = 0;
+        }
+
+        // Append a record to the active segment and point key at it (lock held)
+        void put(uint64_t key, std::string_view bytes){
+            if(failed) throw std::runtime_error("Cannot write segment file: " + active->path);
+            uint64_t size = HEADER_SIZE + bytes.size();
+            if(active->size != 0 && active->size + size > segment_bytes) roll();
+            char hdr[HEADER_SIZE];
+            uint64_t len = bytes.size();
+            std::memcpy(hdr, &key, 8);
+            std::memcpy(hdr + 8, &len, 8);
+            pending.append(hdr, HEADER_SIZE);
+            pending.append(bytes.data(), bytes.size());
+            index[key] = Location{active->id, active->size + HEADER_SIZE, len};
+            active->size += size;
+            active->live += size;
+            if(pending.size() >= WRITE_BLOCK) flush();
+        }
+
+        // Move the live records of closed segment s to the active one and delete its file
+        void compact(const std::shared_ptr<Segment> &s){
+            // Closed segments never change, so they can be read without the lock
+            std::string bytes(s->size, '\0');
+            bool ok = read_at(*s, &bytes[0], bytes.size(), 0);
+            std::lock_guard<std::mutex> lk(m);
+            if(!ok){ failed = true; return; }
+            for(size_t pos = 0; bytes.size() - pos >= HEADER_SIZE; ){
+                uint64_t key, len;
+                std::memcpy(&key, bytes.data() + pos, 8);
+                std::memcpy(&len, bytes.data() + pos + 8, 8);
+                if(len > bytes.size() - pos - HEADER_SIZE) break;
+                auto it = index.find(key);
+                if(it != index.end() && it->second.segment == s->id && it->second.offset == pos + HEADER_SIZE){
+                    put(key, std::string_view(bytes.data() + pos + HEADER_SIZE, len));
+                }
+                pos += HEADER_SIZE + len;
+            }
+            segments.erase(s->id);
+            std::remove(s->path.c_str()); // Open readers keep the data until they are done
+            ++compactions;
+        }
+
+        void compactor_loop(){
+            std::unique_lock<std::mutex> lk(m);
+            while(!stopping){
+                cv.wait(lk, [&]{ return stopping || due; });
+                if(stopping) break;
+                due = false;
+                // A mostly dead segment that is still written to is closed first, so that the space
+                // of dropped versions does not wait for it to fill up
+                if(active->size >= WRITE_BLOCK && active->live * 2 <= active->size){
+                    try { roll(); } catch(const std::exception &) { /* reported by the next append() */ }
+                }
+                std::vector<std::shared_ptr<Segment>> victims;
+                for(auto &e : segments){
+                    if(e.second != active && e.second->live * 2 <= e.second->size) victims.push_back(e.second);
+                }
+                lk.unlock();
+                try { for(auto &s : victims) compact(s); } catch(const std::exception &) { /* reported by the next append() */ }
+                lk.lock();
+            }
+        }
+
+    public:
+        // Open a store in directory d (created if missing), deleting segments left in it by an
+        // earlier run. Segments are closed once they reach seg_bytes.
+        explicit SegmentStore(const std::string &d, uint64_t seg_bytes = uint64_t(64) << 20)
+            : dir(d), segment_bytes(seg_bytes ? seg_bytes : 1) {
+            std::error_code ec;
+            std::filesystem::create_directories(dir, ec);
+            if(!std::filesystem::is_directory(dir, ec)) throw std::runtime_error("Cannot open segment store: " + dir);
+            for(const auto &e : std::filesystem::directory_iterator(dir, ec)){
+                std::string name = e.path().filename().string();
+                if(name.rfind("segment-", 0) == 0 && e.path().extension() == ".seg") std::filesystem::remove(e.path(), ec);
+            }
+            std::lock_guard<std::mutex> lk(m);
+            roll();
+            compactor = std::thread(&SegmentStore::compactor_loop, this);
+        }
+        SegmentStore(const SegmentStore &) = delete;
+        SegmentStore &operator=(const SegmentStore &) = delete;
+        ~SegmentStore(){
+            {
+                std::lock_guard<std::mutex> lk(m);
+                stopping = true;
+            }
+            cv.notify_all();
+            compactor.join();
+        }
+
+        // Store bytes; returns the key to read them back with (never 0, never reused)
+        uint64_t append(std::string_view bytes){
+            std::lock_guard<std::mutex> lk(m);
+            uint64_t key = next_key++;
+            put(key, bytes);
+            return key;
+        }
+
+        // Bytes stored under key
+        std::string read(uint64_t key){
+            std::shared_ptr<Segment> s;
+            Location at;
+            std::string bytes;
+            {
+                std::lock_guard<std::mutex> lk(m);
+                auto it = index.find(key);
+                if(it == index.end()) throw std::runtime_error("Missing segment record");
+                at = it->second;
+                s = segments.at(at.segment);
+                if(s == active && at.offset >= pending_at){
+                    return pending.substr(at.offset - pending_at, at.length);
+                }
+            }
+            bytes.resize(at.length);
+            if(!read_at(*s, &bytes[0], bytes.size(), at.offset)) throw std::runtime_error("Cannot read segment file: " + s->path);
+            return bytes;
+        }
+
+        // Mark the record of key dead; compaction reclaims its space
+        void release(uint64_t key){
+            std::lock_guard<std::mutex> lk(m);
+            auto it = index.find(key);
+            if(it == index.end()) return;
+            Segment &s = *segments.at(it->second.segment);
+            s.live -= HEADER_SIZE + it->second.length;
+            index.erase(it);
+            if((&s != active.get() || s.size >= WRITE_BLOCK) && s.live * 2 <= s.size && !due){
+                due = true;
+                cv.notify_one();
+            }
+        }
+
+        Stats stats(){
+            std::lock_guard<std::mutex> lk(m);
+            Stats st;
+            st.segments = segments.size();
+            st.records = index.size();
+            for(auto &e : segments){
+                st.disk_bytes += e.second->size;
+                st.live_bytes += e.second->live;
+            }
+            st.compactions = compactions;
+            st.pending_bytes = pending.size();
+            return st;
+        }
+
+        // Appended bytes buffered in memory, not written to the active segment yet
+        uint64_t pending_bytes(){
+            std::lock_guard<std::mutex> lk(m);
+            return pending.size();
+        }
+};
+
+#endif // SEGMENT_STORE_H
@@ -0,0 +1,198 @@
+//
+// Listening sockets for server mode.
+//
+// ServerSocket binds either a TCP port on the loopback interface ("<port>") or
+// a Unix domain socket ("unix:<path>") and hands out connected descriptors;
+// connect_to() opens a client connection to the same kinds of address.
+// Connections are plain byte streams, so LineReader and OutputSink work on
+// them exactly as on stdin / stdout. Server mode is POSIX only.
+//
+
+#ifndef SERVER_SOCKET_H
+#define SERVER_SOCKET_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+class ServerSocket
+{
+    private:
+        int fd = -1;
+        std::string unix_path; // Removed again on close (Unix sockets only)
+
+#ifndef _WIN32
+        [[noreturn]] void fail(const std::string &what, const std::string &address){
+            if(fd >= 0) ::close(fd);
+            fd = -1;
+            throw std::runtime_error(what + ": " + address + " (" + std::strerror(errno) + ")");
+        }
+
+        // Socket address of "<port>" (127.0.0.1) or "unix:<path>"; returns its length
+        static socklen_t resolve(const std::string &address, sockaddr_storage &ss){
+            std::memset(&ss, 0, sizeof(ss));
+            if(address.rfind("unix:", 0) == 0){
+                std::string path = address.substr(5);
+                sockaddr_un &sa = reinterpret_cast<sockaddr_un &>(ss);
+                if(path.empty() || path.size() >= sizeof(sa.sun_path)) throw std::runtime_error("Invalid socket path: " + address);
+                sa.sun_family = AF_UNIX;
+                std::memcpy(sa.sun_path, path.data(), path.size());
+                return sizeof(sa);
+            }
+            char* end = nullptr;
+            long port = std::strtol(address.c_str(), &end, 10);
+            if(address.empty() || *end != '\0' || port < 0 || port > 65535) throw std::runtime_error("Invalid listen address: " + address);
+            sockaddr_in &sa = reinterpret_cast<sockaddr_in &>(ss);
+            sa.sin_family = AF_INET;
+            sa.sin_port = htons((uint16_t)port);
+            sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            return sizeof(sa);
+        }
+#endif
+
+    public:
+        // Listen on address: "<port>" (TCP, 127.0.0.1) or "unix:<path>"
+        explicit ServerSocket(const std::string &address, int backlog = 128){
+#ifdef _WIN32
+            (void)backlog;
+            throw std::runtime_error("Server mode is not supported on this platform: " + address);
+#else
+            // A client hanging up must not kill the server when its reply is written
+            signal(SIGPIPE, SIG_IGN);
+            sockaddr_storage sa;
+            socklen_t len = resolve(address, sa);
+            fd = ::socket(sa.ss_family, SOCK_STREAM, 0);
+            if(fd < 0) fail("Cannot create socket", address);
+            if(sa.ss_family == AF_UNIX){
+                unix_path = address.substr(5);
+                ::unlink(unix_path.c_str()); // Left behind by a previous run
+            }
+            else{
+                int one = 1;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            }
+            if(::bind(fd, (sockaddr*)&sa, len) != 0) fail("Cannot bind", address);
+            if(::listen(fd, backlog) != 0) fail("Cannot listen", address);
+#endif
+        }
+        ServerSocket(const ServerSocket &) = delete;
+        ServerSocket &operator=(const ServerSocket &) = delete;
+        ~ServerSocket(){
+#ifndef _WIN32
+            if(fd >= 0) ::close(fd);
+            if(!unix_path.empty()) ::unlink(unix_path.c_str());
+#endif
+        }
+
+        // Port actually bound (useful when listening on port 0); 0 for Unix sockets
+        int port() const {
+#ifndef _WIN32
+            sockaddr_in sa;
+            socklen_t len = sizeof(sa);
+            if(unix_path.empty() && getsockname(fd, (sockaddr*)&sa, &len) == 0) return ntohs(sa.sin_port);
+#endif
+            return 0;
+        }
+
+        // Wait for the next client; returns its connected descriptor, or -1 if accept failed
+        int accept_client(){
+#ifndef _WIN32
+            while(true){
+                int c = ::accept(fd, nullptr, nullptr);
+                if(c >= 0 || errno != EINTR) return c;
+            }
+#else
+            return -1;
+#endif
+        }
+
+        // Connect to a server at address ("<port>" or "unix:<path>"); returns the connected descriptor
+        static int connect_to(const std::string &address){
+#ifdef _WIN32
+            throw std::runtime_error("Server mode is not supported on this platform: " + address);
+#else
+            signal(SIGPIPE, SIG_IGN);
+            sockaddr_storage sa;
+            socklen_t len = resolve(address, sa);
+            int c = ::socket(sa.ss_family, SOCK_STREAM, 0);
+            if(c < 0) throw std::runtime_error("Cannot create socket: " + address + " (" + std::strerror(errno) + ")");
+            if(::connect(c, (sockaddr*)&sa, len) != 0){
+                std::string why = std::strerror(errno);
+                ::close(c);
+                throw std::runtime_error("Cannot connect: " + address + " (" + why + ")");
+            }
+            return c;
+#endif
+        }
+
+        // Write all n bytes to a connection; false if it failed or timed out
+        static bool send_all(int c, const char* p, size_t n){
+#ifndef _WIN32
+            while(n > 0){
+                long w = ::send(c, p, n, 0);
+                if(w < 0){ if(errno == EINTR) continue; return false; }
+                p += w; n -= w;
+            }
+            return true;
+#else
+            (void)c; (void)p; return n == 0;
+#endif
+        }
+
+        // Read exactly n bytes from a connection; false on end of stream, error or timeout
+        static bool receive_all(int c, char* p, size_t n){
+#ifndef _WIN32
+            while(n > 0){
+                long r = ::recv(c, p, n, 0);
+                if(r < 0 && errno == EINTR) continue;
+                if(r <= 0) return false;
+                p += r; n -= r;
+            }
+            return true;
+#else
+            (void)c; (void)p; return n == 0;
+#endif
+        }
+
+        // Make blocked and later reads and writes on a connection fail, without closing it
+        static void shutdown_client(int c){
+#ifndef _WIN32
+            ::shutdown(c, SHUT_RDWR);
+#else
+            (void)c;
+#endif
+        }
+
+        // Make reads and writes on a client give up after the given number of seconds
+        static void set_timeout(int c, int seconds){
+#ifndef _WIN32
+            timeval tv;
+            tv.tv_sec = seconds;
+            tv.tv_usec = 0;
+            setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#else
+            (void)c; (void)seconds;
+#endif
+        }
+
+        static void close_client(int c){
+#ifndef _WIN32
+            ::close(c);
+#endif
+        }
+};
+
+#endif // SERVER_SOCKET_H
@@ -0,0 +1,143 @@
+//
+// Minimal SHA-1 and SHA-256 (FIPS 180-4) used for Git-compatible object ids.
+//
+// Both expose the same incremental interface:
+//     Sha1 h; h.update(data, len); ...; h.final(digest);
+// where digest has DIGEST_SIZE bytes.
+//
+
+#ifndef SHA_HASH_H
+#define SHA_HASH_H
+
+#include <cstdint>
+#include <cstring>
+
+// Shared block buffering and length padding for Merkle-Damgard hashes
+template <typename Impl>
+class ShaBase
+{
+    protected:
+        unsigned char block[64];
+        size_t fill = 0;
+        uint64_t total = 0;
+
+    public:
+        void update(const void* data, size_t len){
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            total += len;
+            if(fill > 0){
+                size_t n = len < 64 - fill ? len : 64 - fill;
+                std::memcpy(block + fill, p, n);
+                fill += n; p += n; len -= n;
+                if(fill < 64) return;
+                static_cast<Impl*>(this)->compress(block);
+                fill = 0;
+            }
+            while(len >= 64){
+                static_cast<Impl*>(this)->compress(p);
+                p += 64; len -= 64;
+            }
+            std::memcpy(block, p, len);
+            fill = len;
+        }
+
+    protected:
+        // Append 0x80, zero padding and the big-endian bit length
+        void pad(){
+            uint64_t bits = total * 8;
+            unsigned char one = 0x80, zero = 0;
+            update(&one, 1);
+            while(fill != 56) update(&zero, 1);
+            unsigned char len_be[8];
+            for(int i = 0; i < 8; ++i) len_be[i] = (unsigned char)(bits >> (56 - 8 * i));
+            update(len_be, 8);
+        }
+
+        static uint32_t rotl(uint32_t x, int n){ return (x << n) | (x >> (32 - n)); }
+        static uint32_t rotr(uint32_t x, int n){ return (x >> n) | (x << (32 - n)); }
+        static uint32_t load_be(const unsigned char* p){
+            return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+        }
+        static void store_be(unsigned char* p, uint32_t v){
+            p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16);
+            p[2] = (unsigned char)(v >> 8); p[3] = (unsigned char)v;
+        }
+};
+
+class Sha1 : public ShaBase<Sha1>
+{
+    private:
+        uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+    public:
+        static constexpr size_t DIGEST_SIZE = 20;
+
+        void compress(const unsigned char* p){
+            uint32_t w[80];
+            for(int i = 0; i < 16; ++i) w[i] = load_be(p + 4 * i);
+            for(int i = 16; i < 80; ++i) w[i] = rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for(int i = 0; i < 80; ++i){
+                uint32_t f, k;
+                if(i < 20){ f = (b & c) | (~b & d); k = 0x5A827999; }
+                else if(i < 40){ f = b ^ c ^ d; k = 0x6ED9EBA1; }
+                else if(i < 60){ f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+                else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+                uint32_t t = rotl(a, 5) + f + e + k + w[i];
+                e = d; d = c; c = rotl(b, 30); b = a; a = t;
+            }
+            h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+        }
+
+        void final(unsigned char* out){
+            pad();
+            for(int i = 0; i < 5; ++i) store_be(out + 4 * i, h[i]);
+        }
+};
+
+class Sha256 : public ShaBase<Sha256>
+{
+    private:
+        uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    public:
+        static constexpr size_t DIGEST_SIZE = 32;
+
+        void compress(const unsigned char* p){
+            static const uint32_t K[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+            uint32_t w[64];
+            for(int i = 0; i < 16; ++i) w[i] = load_be(p + 4 * i);
+            for(int i = 16; i < 64; ++i){
+                uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+                uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+                w[i] = w[i-16] + s0 + w[i-7] + s1;
+            }
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+            for(int i = 0; i < 64; ++i){
+                uint32_t S1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+                uint32_t ch = (e & f) ^ (~e & g);
+                uint32_t t1 = hh + S1 + ch + K[i] + w[i];
+                uint32_t S0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+                uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+                uint32_t t2 = S0 + maj;
+                hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+            }
+            h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+        }
+
+        void final(unsigned char* out){
+            pad();
+            for(int i = 0; i < 8; ++i) store_be(out + 4 * i, h[i]);
+        }
+};
+
+#endif // SHA_HASH_H
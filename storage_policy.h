@@ -0,0 +1,97 @@
+//
+// Compile-time policies File is built with.
+//
+// BasicFile<Policy> (version_file.h) takes three policies, and File is the
+// instantiation this build uses everywhere. Pick them with -D at compile time:
+//
+//   VCS_STORAGE  how versions store their content
+//       DeltaStorage       a delta against the parent (a reused prefix plus new
+//                          bytes), with a keyframe at least every 32 versions
+//                          (default; suits long histories of small changes)
+//       FullCopyStorage    every snapshot stores its whole content (no delta
+//                          chains to walk; suits big files with few versions)
+//       CompressedStorage  deltas as above, and every snapshot's stored bytes
+//                          are LZ-compressed as soon as it is taken (least
+//                          memory; reads decompress through cold_cache)
+//   VCS_NODE_SEGMENT_BITS  log2 of the first NodeArena segment (default 4, i.e.
+//                          16 versions): higher means fewer, larger allocations
+//                          for deep histories, lower less slack per tiny file
+//   VCS_FILE_LOCKS  1 (default): each file has a mutex that serializes changes.
+//                   0: no per-file locking at all, for single-threaded use
+//                   such as replaying a log; server mode is then unavailable.
+//
+// For example: g++ -DVCS_STORAGE=FullCopyStorage -DVCS_FILE_LOCKS=0 ...
+// The benchmark (workload "policies") builds several combinations side by side.
+//
+
+#ifndef STORAGE_POLICY_H
+#define STORAGE_POLICY_H
+
+#include <mutex>
+#include "node_arena.h"
+
+// Content storage policies
+struct DeltaStorage
+{
+    static constexpr int keyframe_interval = 32; // Deltas chained below a keyframe at most
+    static constexpr bool compress_snapshots = false;
+};
+
+struct FullCopyStorage
+{
+    static constexpr int keyframe_interval = 1; // Any delta is rewritten in full when snapshotted
+    static constexpr bool compress_snapshots = false;
+};
+
+struct CompressedStorage
+{
+    static constexpr int keyframe_interval = 32;
+    static constexpr bool compress_snapshots = true;
+};
+
+// Allocator policy: the arena holding a file's versions, first segment 2^BaseBits versions
+template <int BaseBits>
+struct ArenaAllocator
+{
+    template <typename T>
+    using arena = NodeArena<T, BaseBits>;
+};
+
+// Locking policy for files that are never shared between threads: locking does nothing
+struct NoLock
+{
+    void lock() {}
+    bool try_lock() { return true; }
+    void unlock() {}
+};
+
+template <typename Storage, typename Allocator, typename Mutex>
+struct FilePolicy
+{
+    using storage = Storage;
+    using allocator = Allocator;
+    using mutex_type = Mutex;
+};
+
+#ifndef VCS_STORAGE
+#define VCS_STORAGE DeltaStorage
+#endif
+#ifndef VCS_NODE_SEGMENT_BITS
+#define VCS_NODE_SEGMENT_BITS 4
+#endif
+#ifndef VCS_FILE_LOCKS
+#define VCS_FILE_LOCKS 1
+#endif
+
+#if VCS_FILE_LOCKS
+using DefaultFilePolicy = FilePolicy<VCS_STORAGE, ArenaAllocator<VCS_NODE_SEGMENT_BITS>, std::mutex>;
+#else
+using DefaultFilePolicy = FilePolicy<VCS_STORAGE, ArenaAllocator<VCS_NODE_SEGMENT_BITS>, NoLock>;
+#endif
+
+template <typename Policy>
+class BasicFile;
+
+using File = BasicFile<DefaultFilePolicy>;
+
+#endif // STORAGE_POLICY_H
@@ -0,0 +1,141 @@
+//
+// ThreadPool: a fixed set of worker threads running queued jobs.
+//
+// submit() queues a job; the first idle worker runs it. Jobs run to completion
+// on one thread. The destructor stops accepting work, lets the workers finish
+// every job already queued and joins them.
+//
+// parallel_for() runs fn(0) .. fn(n-1) on all workers and waits for them; it
+// must not be called from one of the pool's own workers. It schedules by work
+// stealing: each worker starts with an equal share of the indices and takes
+// them one at a time from the front; a worker that runs out takes the back
+// half of the largest share left. A share is [begin, end) packed into one
+// 64-bit atomic, so taking an index or stealing half a share is one
+// compare-and-swap, and items of very uneven cost still balance out.
+//
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class ThreadPool
+{
+    private:
+        std::mutex m;
+        std::condition_variable cv;
+        std::deque<std::function<void()>> jobs;
+        bool stopping = false;
+        std::vector<std::thread> workers;
+
+        void worker_loop(){
+            while(true){
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lk(m);
+                    cv.wait(lk, [&]{ return stopping || !jobs.empty(); });
+                    if(jobs.empty()) return; // Stopping and drained
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                job();
+            }
+        }
+
+    public:
+        // Start threads workers (at least one)
+        explicit ThreadPool(size_t threads){
+            if(threads == 0) threads = 1;
+            for(size_t i = 0; i < threads; ++i) workers.emplace_back(&ThreadPool::worker_loop, this);
+        }
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+        ~ThreadPool(){
+            {
+                std::lock_guard<std::mutex> lk(m);
+                stopping = true;
+            }
+            cv.notify_all();
+            for(std::thread &t : workers) t.join();
+        }
+
+        size_t size() const { return workers.size(); }
+
+        // Queue job to run on a worker thread
+        void submit(std::function<void()> job){
+            {
+                std::lock_guard<std::mutex> lk(m);
+                jobs.push_back(std::move(job));
+            }
+            cv.notify_one();
+        }
+
+        // Run fn(i) for every i in [0, n) across the workers (n < 2^32), with work stealing.
+        // Rethrows the first exception any fn(i) threw.
+        template <typename Fn>
+        void parallel_for(size_t n, Fn fn){
+            if(n == 0) return;
+            size_t shares = std::min(workers.size(), n);
+            // Share of worker w: begin in the low 32 bits, end in the high 32 bits
+            std::unique_ptr<std::atomic<uint64_t>[]> share(new std::atomic<uint64_t>[shares]);
+            auto pack = [](uint64_t begin, uint64_t end){ return begin | (end << 32); };
+            for(size_t w = 0; w < shares; ++w) share[w] = pack(n * w / shares, n * (w + 1) / shares);
+            std::atomic<bool> failed{false};
+            std::mutex done_mutex;
+            std::condition_variable done_cv;
+            size_t running = shares;
+            std::exception_ptr error;
+            for(size_t w = 0; w < shares; ++w){
+                submit([&, w]{
+                    try {
+                        while(!failed.load(std::memory_order_relaxed)){
+                            // Take the first index of our own share
+                            uint64_t v = share[w].load();
+                            uint64_t begin = uint32_t(v), end = v >> 32;
+                            if(begin < end){
+                                if(share[w].compare_exchange_weak(v, pack(begin + 1, end))) fn(begin);
+                                continue;
+                            }
+                            // Empty: steal the back half of the largest share left, or stop if there is none
+                            size_t victim = shares;
+                            uint64_t most = 0;
+                            for(size_t k = 0; k < shares; ++k){
+                                uint64_t s = share[k].load();
+                                uint64_t left = uint32_t(s) < (s >> 32) ? (s >> 32) - uint32_t(s) : 0;
+                                if(left > most){ most = left; victim = k; }
+                            }
+                            if(victim == shares) break;
+                            uint64_t s = share[victim].load();
+                            begin = uint32_t(s);
+                            end = s >> 32;
+                            if(begin >= end) continue;
+                            uint64_t mid = begin + (end - begin) / 2;
+                            if(share[victim].compare_exchange_strong(s, pack(begin, mid))) share[w] = pack(mid, end);
+                        }
+                    } catch(...) {
+                        std::lock_guard<std::mutex> lk(done_mutex);
+                        if(!error) error = std::current_exception();
+                        failed = true; // Stop handing out work
+                    }
+                    std::lock_guard<std::mutex> lk(done_mutex);
+                    if(--running == 0) done_cv.notify_all();
+                });
+            }
+            std::unique_lock<std::mutex> lk(done_mutex);
+            done_cv.wait(lk, [&]{ return running == 0; });
+            if(error) std::rethrow_exception(error);
+        }
+};
+
+#endif // THREAD_POOL_H
@@ -1,396 +1,1484 @@
-//
-// Simple in-memory versioned file system for a CLI assignment.
-//
-// Commands (type one per line):
-//   CREATE <filename>
-//   READ <filename>
-//   INSERT <filename> <content...>
-//   UPDATE <filename> <content...>
-//   SNAPSHOT <filename> [message...]
-//   ROLLBACK <filename> [version_id]
-//   HISTORY <filename>
-//   RECENT_FILES [k]
-//   BIGGEST_TREES [k]
-//   HELP
-//   EXIT
-//
-// Notes:
-// - INSERT appends to the active content; UPDATE replaces it.
-// - You cannot modify an already snapshotted node; a new child version is created.
-// - HISTORY shows snapshots along the current branch (root -> active).
-// - Errors are reported to stderr as: "Error: <message>".
-//
-
-#include <iostream>
-#include <vector>
-#include <string>
-#include <ctime>
-#include <stdexcept>
-#include <queue>
-using namespace std;
-
-// Helper: check whether a string represents a non-negative integer
-bool is_nonneg_integer(const string &s){
-    if(s.empty()) return false;
-    for(char c : s){ if(c < '0' || c > '9') return false; }
-    return true;
-}
-
-// Function to split a string by spaces into a vector of words (command parser)
-// Example: "INSERT file1 Hello World" -> ["INSERT", "file1", "Hello", "World"]
-// This helps in parsing user commands from input
-vector<string> separate(string s){
-    vector<string> result;
-    string token;
-    int count = 0;
-    for(char c : s){
-        bool ws = (c == ' ' || c == '\t' || c == '\n' );
-        if(ws && count != 2){
-            if(!token.empty()){ result.push_back(token); token.clear(); count ++;}
-        } else {
-            token.push_back(c);
-        }
-    }
-    if(!token.empty()) result.push_back(token);
-    return result;
-}
-
-// Helper to format time_t to human readable string without trailing newline
-string format_time(time_t t){
-    string s = ctime(&t);
-    if(!s.empty() && s.back() == '\n') s.pop_back();
-    return s;
-}
-
-// TreeNode represents a version of a file in the version tree
-// Each node stores content, message, timestamps, parent, and children
-class TreeNode
-{
-    public:
-        int version_id; // Unique version identifier
-        string content; // File content at this version
-        string message; // Snapshot message (if any)
-        time_t created_ts; // Creation timestamp
-        time_t snapshot_ts; // Snapshot timestamp (0 if not a snapshot)
-        TreeNode* parent; // Pointer to parent version
-        vector<TreeNode*> children; // Children versions
-        TreeNode(int id) : content(""), message(""), created_ts(time(0)), version_id(id), snapshot_ts(0), parent(nullptr) {}
-};
-
-// File class manages the version tree for a single file
-// Supports operations: read, insert, update, snapshot, rollback, history
-class File
-{
-    private:
-        TreeNode* active_version; // Current version pointer
-        TreeNode* root; // Root version (initial)
-        int total_versions; // Total number of versions
-        vector<TreeNode*> version_map;
-        time_t last_modification; // Last modification timestamp
-
-    public:
-        File() : total_versions(1), last_modification(time(0)) {
-            root = new TreeNode(0);
-            active_version = root;
-            version_map.push_back(root);
-            snapshot("");
-        }
-
-        // Get last modification timestamp
-        time_t last_ts(){return last_modification;}
-
-        // Get total number of versions
-        int total_ver(){return total_versions;}
-
-        // Read content of current version
-        string read(){return active_version->content;}
-
-        // Insert content at current version (appends if not a snapshot, else creates new version)
-        void insert(string content){
-            last_modification = time(0);
-            if (active_version->snapshot_ts == 0){
-                active_version->content += content;
-            }
-            else{
-                TreeNode* nd = new TreeNode(total_versions);
-                total_versions ++;
-                nd->content = active_version->content + content;
-                active_version->children.push_back(nd);
-                nd->parent = active_version;
-                active_version = nd;
-                version_map.push_back(active_version);
-            }
-        }
-
-        // Update content at current version (replaces if not a snapshot, else creates new version)
-        void update(string content){
-            last_modification = time(0);
-            if (active_version->snapshot_ts == 0){
-                active_version->content = content;
-            }
-            else{
-                TreeNode* nd = new TreeNode(total_versions );
-                total_versions ++;
-                nd->content = content;
-                active_version->children.push_back(nd);
-                nd->parent = active_version;
-                active_version = nd;
-                version_map.push_back(active_version);
-            }
-        }
-
-        // Create a snapshot at current version with optional message
-        void snapshot(string mess = ""){
-            if(active_version->snapshot_ts != 0) {
-                throw runtime_error("Current version is already a snapshot");
-            }
-            last_modification = time(0);
-            active_version -> snapshot_ts = time(0);
-            active_version -> message = mess;
-        }
-
-        // Rollback to a previous version by id, or to parent if no id given
-        void rollback(int id = -1){
-            if(id != -1) {
-                if(id < 0 || id >= total_versions) {
-                    throw out_of_range("Invalid version id for rollback");
-                }
-                active_version = version_map[id];
-            } else {
-                if(active_version->parent == nullptr) {
-                    throw runtime_error("No parent version to rollback to");
-                }
-                active_version = active_version->parent;
-            }
-        }
-
-    // Print history of all snapshots along the current branch (root -> active).
-    // Returns the count of snapshot entries printed.
-    int history(){
-            vector<TreeNode*> path;
-            TreeNode* curr = active_version;
-            while(curr != nullptr){ path.push_back(curr); curr = curr->parent; }
-            // path currently active->root, reverse to root->active
-        int count = 0;
-            for(auto it = path.rbegin(); it != path.rend(); ++it){
-                TreeNode* node = *it;
-                if(node->snapshot_ts != 0){
-                    cout << "Version " << node->version_id << endl
-                         << " | Created: " << format_time(node->created_ts)
-                         << " | Snapshot: " << format_time(node->snapshot_ts)
-                         << " | Message: " << node->message << endl;
-            ++count;
-                }
-            }
-        return count;
-        }
-};
-
-// 3D vector to store files: first char ASCII, last char ASCII, list of (filename, File*)
-// Allow full 8-bit character set for first/last chars safely (0..255)
-vector<vector<vector<pair<string,File*>>>> all_files(256, vector<vector<pair<string,File*>>>(256));
-
-int main()
-{
-
-    // Heap for BIGGEST_TREES (by version count)
-    vector<pair<int,string>> version_heap;
-
-    // Heap for RECENT_FILES (by last modification time)
-    vector<pair<time_t,string>> recent_files_heap;
-
-    while (true)
-    {
-        try {
-            // Read user input (command)
-            string input;
-            if(!getline(cin,input)) {
-                // Graceful exit on EOF (e.g., Ctrl+Z in Windows console)
-                break;
-            }
-            vector<string> command = separate(input);
-
-            if (command.empty()) continue;
-
-            // HELP: show usage
-            if(command[0] == "HELP"){
-                cout << "Available commands:\n"
-                     << "  CREATE <filename>\n"
-                     << "  READ <filename>\n"
-                     << "  INSERT <filename> <content...>\n"
-                     << "  UPDATE <filename> <content...>\n"
-                     << "  SNAPSHOT <filename> [message...]\n"
-                     << "  ROLLBACK <filename> [version_id]\n"
-                     << "  HISTORY <filename>\n"
-                     << "  RECENT_FILES [k]\n"
-                     << "  BIGGEST_TREES [k]\n"
-                     << "  HELP\n"
-                     << "  EXIT\n";
-                cout << endl;
-                continue;
-            }
-            // EXIT: terminate program
-            if(command[0] == "EXIT"){
-                cout << "Exiting..." << endl;
-                break;
-            }
-
-            // CREATE <filename>: create a new file
-            if (command[0] == "CREATE"){
-                if(command.size() < 2) throw std::invalid_argument("CREATE command requires a file name");
-                string name = command[1];
-                if(name.empty()) throw invalid_argument("File name cannot be empty");
-                int i = (unsigned char)name.front();
-                int j = (unsigned char)name.back();
-                for (auto &p : all_files[i][j]) {
-                    if (p.first == name) throw invalid_argument("File already exists");
-                }
-                File* f = new File();
-                all_files[i][j].push_back({name, f});
-
-                cout << "[CREATE] File created: " << name << endl;
-                cout << endl;
-            }
-
-            // RECENT_FILES: list files by most recent modification
-            else if( command[0] == "RECENT_FILES") {
-                using T = pair<time_t, string>;
-                auto cmp = [](const T& a, const T& b) { return a.first < b.first; };
-                priority_queue<T, vector<T>, decltype(cmp)> pq(cmp);
-                for(int i = 0; i < 256; ++i) {
-                    for(int j = 0; j < 256; ++j) {
-                        for(auto &p : all_files[i][j]) {
-                            File* f = p.second;
-                            pq.push({f->last_ts(), p.first});
-                        }
-                    }
-                }
-                int num = pq.size();
-                if(command.size() > 1) {
-                    if(!is_nonneg_integer(command[1])) throw invalid_argument("RECENT_FILES requires a non-negative integer argument");
-                    num = stoi(command[1]);
-                }
-                if(num > (int)pq.size()) throw invalid_argument("RECENT_FILES: requested number exceeds total files");
-                cout << "[RECENT_FILES] Showing " << num << " file(s):" << endl;
-                for(int k = 0; k < num && !pq.empty(); ++k){
-                    auto pr = pq.top(); pq.pop();
-                    cout << pr.second << " -> " << format_time(pr.first) << endl;
-                }
-                cout << endl;
-            }
-
-            // BIGGEST_TREES: list files by number of versions (largest first)
-            else if( command[0] == "BIGGEST_TREES") {
-                using T = pair<int, string>;
-                auto cmp = [](const T& a, const T& b) { return a.first < b.first; };
-                priority_queue<T, vector<T>, decltype(cmp)> pq(cmp);
-                for(int i = 0; i < 256; ++i) {
-                    for(int j = 0; j < 256; ++j) {
-                        for(auto &p : all_files[i][j]) {
-                            File* f = p.second;
-                            pq.push({f->total_ver(), p.first});
-                        }
-                    }
-                }
-                int num = pq.size();
-                if(command.size() > 1) {
-                    if(!is_nonneg_integer(command[1])) throw invalid_argument("BIGGEST_TREES requires a non-negative integer argument");
-                    num = stoi(command[1]);
-                }
-                if(num > (int)pq.size()) throw invalid_argument("BIGGEST_TREES: requested number exceeds total files");
-                cout << "[BIGGEST_TREES] Showing " << num << " file(s) by version count:" << endl;
-                for(int k = 0; k < num && !pq.empty(); ++k){
-                    auto pr = pq.top(); pq.pop();
-                    cout << pr.second << " -> " << pr.first << endl;
-                }
-                cout << endl;
-            }
-
-            // File-specific commands: READ, INSERT, UPDATE, SNAPSHOT, ROLLBACK, HISTORY
-            else if(command[0] == "READ" || command[0] == "INSERT" || command[0] == "UPDATE" || command[0] == "SNAPSHOT" || command[0] == "ROLLBACK" || command[0] == "HISTORY"){
-                if(command.size() < 2) throw invalid_argument("Command requires a file name");
-
-                string name = command[1];
-                if(name.empty()) throw invalid_argument("File name cannot be empty");
-                int i = (unsigned char)name.front();
-                int j = (unsigned char)name.back();
-                File* z = nullptr;
-                for(auto &p : all_files[i][j]) if(p.first == name) { z = p.second; break; }
-                if(z == nullptr) throw runtime_error("File not found");
-                
-                // READ <filename>: print file content
-                if(command[0] == "READ"){
-                    cout << "[READ] Content of file '" << name << "':\n";
-                    cout << z->read() << endl;
-                    cout << endl;
-                }
-
-                // INSERT <filename> <content>: append content to file
-                else if(command[0] == "INSERT"){
-                    string content = (command.size() == 2) ? "" : command[2];
-                    z->insert(content);
-                    cout << "[INSERT] Content inserted into file '" << name << "':\n" << content << endl;
-                    cout << "Current content:\n" << z->read() << endl;
-                    cout << endl;
-                }
-
-                // UPDATE <filename> <content>: replace file content
-                else if(command[0] == "UPDATE"){
-                    string content = (command.size() == 2) ? "" : command[2];
-                    z->update(content);
-                    cout << "[UPDATE] Content updated in file '" << name << "':\n" << content << endl;
-                    cout << "Current content:\n" << z->read() << endl;
-                    cout << endl;
-                }
-
-                // SNAPSHOT <filename> <message>: create a snapshot with optional message
-                else if(command[0] == "SNAPSHOT"){
-                    string message = (command.size() == 2) ? "" : command[2];
-                    z->snapshot(message);
-                    cout << "[SNAPSHOT] Snapshot created for file '" << name << "'." << endl;
-                    if(!message.empty()) cout << "Message: " << message << endl;
-                    cout << endl;
-                }
-
-                // ROLLBACK <filename> [version_id]: rollback to previous version or to given version id
-                else if(command[0] == "ROLLBACK"){
-                    if(command.size() > 3) throw invalid_argument("ROLLBACK command takes at most one argument");
-                    if(command.size() == 2){
-                        z->rollback();
-                        cout << "[ROLLBACK] File '" << name << "' rolled back to previous version." << endl;
-                        cout << "Current content:\n" << z->read() << endl;
-                        cout << endl;
-                    }
-                    else{
-                        if(!is_nonneg_integer(command[2])) throw invalid_argument("ROLLBACK requires a non-negative integer version id");
-                        int ver = stoi(command[2]);
-                        z->rollback(ver);
-                        cout << "[ROLLBACK] File '" << name << "' rolled back to version " << ver << "." << endl;
-                        cout << "Current content:\n" << z->read() << endl;
-                        cout << endl;
-                    }
-                }
-
-                // HISTORY <filename>: print all snapshots for the file
-                else if(command[0] == "HISTORY"){
-                    cout << "[HISTORY] Snapshots for file '" << name << "':" << endl;
-                    int cnt = z->history();
-                    if(cnt == 0){
-                        cout << "(no snapshots yet)" << endl;
-                    }
-                    cout << endl;
-                }
-            }
-
-            // Unknown command handler
-            else{
-                    throw invalid_argument("Unknown command: " + command[0]);
-                }
-
-    } catch(const exception& e) {
-            cerr << "Error: " << e.what() << endl;
-            cout << endl;
-        }
-    }
-    return 0;
-}
\ No newline at end of file
+//
+// Simple in-memory versioned file system for a CLI assignment.
+//
+// Commands (type one per line):
+//   CREATE <filename>
+//   READ <filename> [offset length]
+//   INSERT <filename> <content...>
+//   UPDATE <filename> <content...>
+//   SNAPSHOT <filename> [message...]
+//   SNAPSHOT_ALL [message...]
+//   ROLLBACK <filename> [version_id]
+//   HISTORY <filename> [n [cursor]]
+//   COMMON_ANCESTOR <filename> <version_id> <version_id>
+//   DIFF <filename> <version_id> <version_id> [lines|bytes]
+//   BRANCH <filename> <name> [version_id]
+//   TAG <filename> <name> [version_id]
+//   CHECKOUT <filename> <name | version_id>
+//   REFS <filename>
+//   GC [filename]
+//   PRUNE <filename> <n>
+//   STATS
+//   SEARCH <pattern> [filename]
+//   BEGIN / COMMIT / ABORT
+//   RECENT_FILES [k]
+//   BIGGEST_TREES [k]
+//   SAVE <path>
+//   LOAD <path>
+//   CHECKPOINT
+//   IMPORT <directory | git:repository> [message...]
+//   BATCH [normal|quiet|summary|off]
+//   HELP
+//   EXIT
+//
+// Notes:
+// - INSERT appends to the active content; UPDATE replaces it.
+// - You cannot modify an already snapshotted node; a new child version is created.
+// - HISTORY shows snapshots along the current branch (root -> active).
+// - A checked-out BRANCH follows the active version; a TAG stays where it was made.
+// - Between BEGIN and COMMIT, INSERT / UPDATE / SNAPSHOT are queued and then applied together.
+// - Errors are reported to stderr as: "Error: <message>".
+// - With --listen=<port|unix:path> the same commands are served to concurrent socket clients.
+// - With --metrics=<port|unix:path> server mode also serves STATS as Prometheus metrics over HTTP.
+// - With --cold-after=<seconds>, snapshots off the active path that go unused that long are
+//   kept compressed and decompressed on demand; with --store=<dir> their bytes are also moved
+//   out of memory to segment files in <dir> and read back from disk when needed.
+// - With --memory-budget=<MB>, the least recently used snapshots are evicted the same way
+//   whenever the version content held in memory grows past the budget.
+// - With --replicate=<port|unix:path> every change is also streamed to the replicas that
+//   connect there; a process started with --replica-of=<port|unix:path> follows that primary
+//   and serves the queries (READ, HISTORY, RECENT_FILES, ...) but refuses changes.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <ctime>
+#include <filesystem>
+#include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include "file_index.h"
+#include "version_file.h"
+#include "command_parser.h"
+#include "diff.h"
+#include "importer.h"
+#include "line_reader.h"
+#include "metrics.h"
+#include "output_sink.h"
+#include "repo_format.h"
+#include "replication.h"
+#include "server_socket.h"
+#include "thread_pool.h"
+#include "wal.h"
+using namespace std;
+
+// Helper: check whether a string represents a non-negative integer
+bool is_nonneg_integer(string_view s){
+    if(s.empty()) return false;
+    for(char c : s){ if(c < '0' || c > '9') return false; }
+    return true;
+}
+
+// Helper: parse a token already checked with is_nonneg_integer (throws out_of_range if too large)
+int to_int(string_view s){
+    return stoi(string(s));
+}
+
+// Hash index of all files: filename -> File* (see file_index.h); looked up without locking
+FileIndex all_files(epochs);
+
+// Pool holding every File object (stable addresses, freed together at exit)
+NodeArena<File> file_pool;
+
+// Guards the set of files (all_files, file_pool): shared by commands on existing files,
+// exclusive for commands that add files or need all of them at once (see CommandLocks)
+shared_mutex files_mutex;
+
+// Keeps the lock-free queries away from what they must not overlap: shared by READ, HISTORY and
+// COMMON_ANCESTOR, exclusive (after files_mutex) for GC, PRUNE and the cold sweep, which rewrite
+// snapshots in place, and for COMMIT, whose files must all appear changed at once
+shared_mutex rewrite_mutex;
+
+// Worker threads for passes over the whole file set (SNAPSHOT_ALL, GC, the cold sweep, IMPORT),
+// which hand them one file per index through parallel_for(). Started on first use.
+ThreadPool &maintenance_pool(){
+    static ThreadPool pool(thread::hardware_concurrency() ? thread::hardware_concurrency() : 4);
+    return pool;
+}
+
+// Files GC without a file name prunes under one hold of the file set
+const size_t GC_BATCH = 256;
+
+// Recency / size rankings of all files, maintained incrementally by File
+FileRankings rankings;
+
+// Write-ahead log of mutating commands (null unless started with --wal)
+WriteAheadLog* wal = nullptr;
+string checkpoint_path; // Checkpoint the WAL is compacted into
+uint64_t checkpoint_bytes = 64 << 20; // Automatic CHECKPOINT once the WAL grows past this
+
+// Replicas the changes are streamed to (null unless started with --replicate)
+ReplicationHub* replication = nullptr;
+
+// Connection to the primary this process replicates (null unless started with --replica-of)
+ReplicaLink* replica_link = nullptr;
+
+// Write every file, in creation order, to a repository file at path. Returns the number of files saved.
+// wal_seq records the last WAL record the saved state includes.
+size_t save_repository(const string &path, uint64_t wal_seq = 0){
+    RepoWriter w;
+    unordered_map<const char*, uint64_t> blob_ids;
+    for(uint32_t i = 0; i < file_pool.size(); ++i) file_pool[i].save(w, blob_ids);
+    w.write(path, (uint32_t)blob_store.hash_mode(), wal_seq);
+    return file_pool.size();
+}
+
+// Fold the WAL into a fresh checkpoint and empty it. save_repository() returns only once the
+// checkpoint is on disk (file and rename fsync'ed), so the log is never emptied before that.
+void checkpoint(){
+    if(wal == nullptr) throw runtime_error("CHECKPOINT requires a write-ahead log (--wal)");
+    wal->sync();
+    save_repository(checkpoint_path, wal->last_seq());
+    wal->reset();
+}
+
+// Record a change that has succeeded, with the command's clock: in the WAL and for the replicas.
+// Called with the command's locks held, so both see conflicting changes in the order they ran.
+void log_change(string_view record){
+    if(wal != nullptr) wal->append(record, command_clock);
+    if(replication != nullptr) replication->publish(record, command_clock);
+}
+
+// Cold version compression (--cold-after): versions unused for cold_after seconds are
+// compressed (and with --store moved to disk) by a sweep that runs after commands, a
+// bounded slice at a time
+long long cold_after = -1; // Off when negative
+const size_t COLD_SWEEP_BUDGET = 4096; // Versions looked at per slice
+atomic<Timestamp> next_cold_pass{0}; // Earliest start of the next pass over all files
+uint32_t cold_file = 0, cold_version = 0; // Where the current pass has got to (guarded by files_mutex)
+
+// Memory budget (--memory-budget): while the version content held in memory (the blob store,
+// the cold cache, the append buffers of versions being appended to and the segment store's
+// unwritten tail) is over it, the sweep runs after every command and also evicts, in
+// CLOCK order, the snapshots not used since its previous pass over all files began (the pass
+// is the clock hand, and using a version sets its reference bit), active path included but
+// for the versions the active content is rebuilt from. Evicted versions are compressed and
+// with --store moved to disk; they are read back through the cold cache on demand.
+size_t memory_budget = 0; // Off when 0
+Timestamp pass_start = 0, previous_pass_start = 0; // When the current / previous pass began (guarded by files_mutex)
+// A whole pass over budget that found nothing to evict: the next waits a second, or until the
+// content held has grown by a 64th of the budget since
+atomic<Timestamp> next_budget_pass{0};
+atomic<size_t> budget_stalled_at{0};
+bool pass_evicted = false; // The current pass has evicted something (guarded by files_mutex)
+atomic<uint64_t> budget_evictions{0}; // Versions compressed or moved to disk to meet the budget
+
+size_t resident_bytes(){
+    return blob_store.bytes() + cold_cache.size_bytes() + AppendBuffer::allocated_bytes()
+        + (segment_store ? segment_store->pending_bytes() : 0);
+}
+
+// Run one slice of the cold sweep if one is due. Skipped when another command holds the
+// file set or a query is running; a later command picks the slice up.
+void sweep_cold(){
+    Timestamp t = clock_now();
+    size_t resident = memory_budget != 0 ? resident_bytes() : 0;
+    bool over = resident > memory_budget && (t >= next_budget_pass.load(memory_order_relaxed)
+                                             || resident > budget_stalled_at.load(memory_order_relaxed) + memory_budget / 64);
+    if(!over && (cold_after < 0 || t < next_cold_pass.load(memory_order_relaxed))) return;
+    unique_lock<shared_mutex> whole(files_mutex, try_to_lock);
+    if(!whole.owns_lock()) return;
+    unique_lock<shared_mutex> rewriting(rewrite_mutex, try_to_lock); // Never waits for queries
+    if(!rewriting.owns_lock()) return;
+    if(pass_start == 0) previous_pass_start = pass_start = t;
+    Timestamp cutoff = cold_after >= 0 ? t - cold_after * NS_PER_SECOND : INT64_MIN;
+    if(over) cutoff = max(cutoff, previous_pass_start);
+    // Cut the slice into one run of versions per file, then compress the files in parallel
+    struct Run { File* file; uint32_t from; size_t count; size_t compressed = 0, spilled = 0; };
+    vector<Run> runs;
+    size_t budget = COLD_SWEEP_BUDGET;
+    while(budget > 0 && cold_file < file_pool.size()){
+        File &f = file_pool[cold_file];
+        size_t count = min<size_t>(budget, f.total_ver() - min<uint32_t>(cold_version, f.total_ver()));
+        if(count > 0) runs.push_back(Run{&f, cold_version, count});
+        budget -= count;
+        cold_version += count;
+        if(cold_version >= (uint32_t)f.total_ver()){ ++cold_file; cold_version = 0; }
+    }
+    auto compress = [&](size_t i){
+        size_t left = runs[i].count;
+        runs[i].file->compress_cold(cutoff, runs[i].from, left, runs[i].compressed, runs[i].spilled, over);
+    };
+    if(runs.size() == 1) compress(0);
+    else maintenance_pool().parallel_for(runs.size(), compress);
+    if(over){
+        size_t evicted = 0;
+        for(const Run &r : runs) evicted += segment_store ? r.spilled : r.compressed;
+        budget_evictions.fetch_add(evicted, memory_order_relaxed);
+        pass_evicted = pass_evicted || evicted > 0;
+    }
+    if(cold_file >= file_pool.size()){
+        cold_file = 0;
+        if(cold_after >= 0) next_cold_pass.store(t + max(cold_after / 2, 1LL) * NS_PER_SECOND, memory_order_relaxed);
+        if(over && !pass_evicted){
+            next_budget_pass.store(t + NS_PER_SECOND, memory_order_relaxed);
+            budget_stalled_at.store(resident, memory_order_relaxed);
+        }
+        previous_pass_start = pass_start;
+        pass_start = t;
+        pass_evicted = false;
+    }
+}
+
+// Repository figures reported by STATS and the metrics endpoint, gathered when asked for
+struct RepoStats
+{
+    FileStats files;
+    size_t file_count, index_slots, index_deleted, probe_total, probe_longest;
+    size_t blobs, stored_bytes;
+    size_t cache_bytes;
+    size_t append_bytes; // Capacity of the append buffers
+    uint64_t cache_hits, cache_misses;
+    uint64_t evictions;
+    uint64_t wal_bytes;
+    SegmentStore::Stats store;
+    ReplicationHub::Stats replication;
+    ReplicaLink::Stats replica;
+};
+
+// Needs the file set (shared or exclusive); locks each file in turn to count its versions
+RepoStats gather_stats(){
+    RepoStats s;
+    for(uint32_t i = 0; i < file_pool.size(); ++i){
+        const File &f = file_pool[i];
+        lock_guard<File::mutex_type> lk(f.mutex());
+        f.add_stats(s.files);
+    }
+    s.file_count = all_files.size();
+    s.index_slots = all_files.capacity();
+    s.index_deleted = all_files.deleted();
+    all_files.probe_lengths(s.probe_total, s.probe_longest);
+    s.blobs = blob_store.count();
+    s.stored_bytes = blob_store.bytes();
+    s.cache_bytes = cold_cache.size_bytes();
+    s.append_bytes = AppendBuffer::allocated_bytes();
+    s.cache_hits = cold_cache.hits();
+    s.cache_misses = cold_cache.misses();
+    s.evictions = budget_evictions.load(memory_order_relaxed);
+    s.wal_bytes = wal != nullptr ? wal->size() : 0;
+    if(segment_store) s.store = segment_store->stats();
+    if(replication != nullptr) s.replication = replication->stats();
+    if(replica_link != nullptr) s.replica = replica_link->stats();
+    return s;
+}
+
+// What the memory budget counts (see resident_bytes())
+size_t memory_used(const RepoStats &s){
+    return s.stored_bytes + s.cache_bytes + s.append_bytes + s.store.pending_bytes;
+}
+
+// Ascending version ids as a list of ranges, e.g. "1-3, 5, 8-9"
+void print_id_ranges(OutputSink &out, const vector<uint32_t> &ids){
+    for(size_t i = 0; i < ids.size(); ){
+        size_t j = i;
+        while(j + 1 < ids.size() && ids[j + 1] == ids[j] + 1) ++j;
+        if(i != 0) out << ", ";
+        out << ids[i];
+        if(j != i) out << "-" << ids[j];
+        i = j + 1;
+    }
+}
+
+// STATS output
+void print_stats(OutputSink &out, const RepoStats &s){
+    char mean_probe[32];
+    snprintf(mean_probe, sizeof(mean_probe), "%.2f", s.file_count ? double(s.probe_total) / s.file_count : 0.0);
+    out << "[STATS]" << '\n'
+        << "Files: " << s.file_count << " (index: " << s.index_slots << " slots, " << s.file_count << " used, "
+        << s.index_deleted << " deleted, mean probe " << mean_probe << ", longest " << s.probe_longest << ")" << '\n'
+        << "Versions: " << s.files.versions << " (" << s.files.snapshots << " snapshots, " << s.files.pruned << " pruned, "
+        << s.files.compressed << " compressed, " << s.files.spilled << " on disk), refs: " << s.files.refs << '\n'
+        << "Tree nodes: " << s.files.versions << " x " << sizeof(TreeNode) << " bytes = " << s.files.versions * sizeof(TreeNode) << " bytes" << '\n'
+        << "Content: " << s.files.logical_bytes << " logical bytes, " << s.files.own_bytes << " stored by versions, "
+        << s.stored_bytes << " in " << s.blobs << " blob(s)" << '\n'
+        << "Cold cache: " << s.cache_bytes << " bytes, " << s.cache_hits << " hit(s), " << s.cache_misses << " miss(es)" << '\n';
+    if(memory_budget != 0){
+        char hit_rate[32];
+        uint64_t lookups = s.cache_hits + s.cache_misses;
+        snprintf(hit_rate, sizeof(hit_rate), "%.1f%%", lookups ? 100.0 * s.cache_hits / lookups : 0.0);
+        out << "Memory budget: " << memory_used(s) << " of " << memory_budget << " bytes in use (blob store " << s.stored_bytes
+            << ", cold cache " << s.cache_bytes << ", append buffers " << s.append_bytes << ", unwritten segment bytes "
+            << s.store.pending_bytes << "), " << s.evictions << " version(s) evicted, cold cache hit rate " << hit_rate << '\n';
+    }
+    if(wal != nullptr) out << "Write-ahead log: " << s.wal_bytes << " bytes" << '\n';
+    if(segment_store){
+        out << "Segment store: " << s.store.segments << " segment(s), " << s.store.disk_bytes << " bytes on disk, "
+            << s.store.live_bytes << " live in " << s.store.records << " record(s), " << s.store.compactions << " compacted" << '\n';
+    }
+    if(replication != nullptr){
+        out << "Replication: " << s.replication.replicas << " replica(s), " << s.replication.last_seq << " change(s) published, "
+            << s.replication.batches << " batch(es) of " << s.replication.records << " record(s) sent (" << s.replication.bytes
+            << " bytes), " << s.replication.dropped << " replica(s) dropped" << '\n';
+    }
+    if(replica_link != nullptr){
+        out << "Replica of " << replica_link->primary() << ": " << (s.replica.connected ? "connected" : "disconnected") << ", applied "
+            << s.replica.applied_seq << " of " << s.replica.primary_seq << " change(s), lag " << s.replica.lag / 1000 << " us, last contact "
+            << (clock_now() - s.replica.last_contact) / 1000000 << " ms ago, " << s.replica.batches << " batch(es), "
+            << s.replica.errors << " error(s)" << '\n';
+    }
+#if VCS_METRICS
+    command_metrics.print(out);
+#else
+    out << "(command metrics not compiled in)" << '\n';
+#endif
+    out << '\n';
+}
+
+// The same figures in Prometheus text exposition format
+void print_prometheus(OutputSink &out, const RepoStats &s){
+    auto metric = [&](const char* name, const char* type, const char* help, uint64_t value){
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n' << name << ' ' << value << '\n';
+    };
+    metric("vcs_files", "gauge", "Files in the repository.", s.file_count);
+    metric("vcs_file_index_slots", "gauge", "Slots allocated in the file name index.", s.index_slots);
+    metric("vcs_file_index_deleted_slots", "gauge", "Deleted slots in the file name index.", s.index_deleted);
+    metric("vcs_file_index_probe_length_max", "gauge", "Longest probe sequence in the file name index.", s.probe_longest);
+    metric("vcs_versions", "gauge", "Versions (tree nodes) of all files.", s.files.versions);
+    metric("vcs_snapshots", "gauge", "Snapshotted versions.", s.files.snapshots);
+    metric("vcs_pruned_versions", "gauge", "Versions dropped by GC or PRUNE.", s.files.pruned);
+    metric("vcs_compressed_versions", "gauge", "Cold versions stored compressed.", s.files.compressed);
+    metric("vcs_refs", "gauge", "Branches and tags.", s.files.refs);
+    metric("vcs_tree_node_bytes", "gauge", "Memory taken by tree nodes.", s.files.versions * sizeof(TreeNode));
+    metric("vcs_logical_bytes", "gauge", "Content lengths of all live versions added up.", s.files.logical_bytes);
+    metric("vcs_version_bytes", "gauge", "Bytes stored by versions before deduplication.", s.files.own_bytes);
+    metric("vcs_stored_bytes", "gauge", "Bytes held by the blob store.", s.stored_bytes);
+    metric("vcs_blobs", "gauge", "Blobs in the blob store.", s.blobs);
+    metric("vcs_cold_cache_bytes", "gauge", "Decompressed bytes held by the cold cache.", s.cache_bytes);
+    metric("vcs_cold_cache_hits_total", "counter", "Cold cache hits.", s.cache_hits);
+    metric("vcs_cold_cache_misses_total", "counter", "Cold cache misses.", s.cache_misses);
+    if(memory_budget != 0){
+        metric("vcs_memory_budget_bytes", "gauge", "Memory budget for version content.", memory_budget);
+        metric("vcs_memory_used_bytes", "gauge", "Version content held in memory, as counted against the budget.", memory_used(s));
+        metric("vcs_append_buffer_bytes", "gauge", "Capacity of the buffers of versions being appended to.", s.append_bytes);
+        metric("vcs_segment_pending_bytes", "gauge", "Segment store bytes not written to disk yet.", s.store.pending_bytes);
+        metric("vcs_evicted_versions_total", "counter", "Versions compressed or moved to disk to meet the memory budget.", s.evictions);
+    }
+    if(wal != nullptr) metric("vcs_wal_bytes", "gauge", "Size of the write-ahead log.", s.wal_bytes);
+    if(segment_store){
+        metric("vcs_spilled_versions", "gauge", "Cold versions whose bytes are in the segment store.", s.files.spilled);
+        metric("vcs_segments", "gauge", "Files in the segment store.", s.store.segments);
+        metric("vcs_segment_bytes", "gauge", "Size of the segment files.", s.store.disk_bytes);
+        metric("vcs_segment_live_bytes", "gauge", "Bytes of live records in the segment files.", s.store.live_bytes);
+        metric("vcs_segment_compactions_total", "counter", "Segments compacted away.", s.store.compactions);
+    }
+    if(replication != nullptr){
+        metric("vcs_replicas", "gauge", "Replicas connected.", s.replication.replicas);
+        metric("vcs_replication_published_seq", "counter", "Changes published to replicas.", s.replication.last_seq);
+        metric("vcs_replication_batches_total", "counter", "Batches sent to replicas.", s.replication.batches);
+        metric("vcs_replication_sent_bytes_total", "counter", "Bytes of batches sent to replicas.", s.replication.bytes);
+        metric("vcs_replication_dropped_total", "counter", "Replicas disconnected for failing or falling behind.", s.replication.dropped);
+    }
+    if(replica_link != nullptr){
+        metric("vcs_replica_connected", "gauge", "Whether the replica is connected to its primary.", s.replica.connected);
+        metric("vcs_replica_applied_seq", "gauge", "Last change of the primary applied.", s.replica.applied_seq);
+        metric("vcs_replica_primary_seq", "gauge", "Last change the primary has reported.", s.replica.primary_seq);
+        metric("vcs_replica_lag_microseconds", "gauge", "Time from the last change applied being made on the primary to being applied.",
+               (uint64_t)(s.replica.lag / 1000));
+        metric("vcs_replica_errors_total", "counter", "Changes from the primary that failed to apply.", s.replica.errors);
+    }
+#if VCS_METRICS
+    command_metrics.print_prometheus(out);
+#endif
+}
+
+// Open a repository file and register its files; their versions stay in the
+// mapped image until each file is first modified. Returns the number of files loaded.
+size_t load_image(const shared_ptr<const RepoImage> &image);
+size_t load_repository(const string &path){
+    if(all_files.size() != 0) throw runtime_error("LOAD requires an empty file system");
+    shared_ptr<const RepoImage> image = make_shared<RepoImage>(path);
+    return load_image(image);
+}
+
+// Register the files of an opened repository image
+size_t load_image(const shared_ptr<const RepoImage> &image){
+    for(uint64_t i = 0; i < image->file_count(); ++i){
+        const RepoFileRecord &rec = image->file(i);
+        string_view name = image->name(rec);
+        if(name.empty() || all_files.find(name) != nullptr) throw runtime_error("Invalid repository file");
+        all_files.insert(name, file_pool.emplace_back(image, rec, &rankings));
+        clock_observe(rec.last_modification); // New timestamps sort after the loaded ones
+    }
+    return image->file_count();
+}
+
+// Create the files of an import plan. Files get their versions in parallel (each file is built
+// by one thread); a name clash is reported before anything is created. Returns the number of
+// files created and sets versions to the number of versions added.
+size_t import_plan(ImportPlan &plan, ThreadPool &pool, size_t &versions){
+    unordered_set<string_view> names;
+    for(const ImportFile &f : plan.files){
+        if(all_files.find(f.name) != nullptr || !names.insert(f.name).second) {
+            throw runtime_error("File already exists: " + f.name);
+        }
+    }
+    Timestamp clock = command_clock;
+    vector<File*> made;
+    made.reserve(plan.files.size());
+    for(const ImportFile &f : plan.files){
+        command_clock = f.versions.empty() ? clock : f.versions.front().ts;
+        File* file = file_pool.emplace_back(f.name, all_files.size(), &rankings);
+        all_files.insert(f.name, file);
+        made.push_back(file);
+    }
+    command_clock = clock;
+    atomic<size_t> added{0};
+    pool.parallel_for(made.size(), [&](size_t i){
+        for(const ImportVersion &v : plan.files[i].versions){
+            command_clock = v.ts; // This worker's clock
+            made[i]->update(plan.contents[v.content]);
+            made[i]->snapshot(v.message);
+        }
+        added += plan.files[i].versions.size();
+    });
+    versions = added;
+    return made.size();
+}
+
+// IMPORT: bulk-load a directory tree, or with "git:" a Git repository's history. Not logged:
+// with a WAL the result is checkpointed right away, so recovery never re-reads the source.
+size_t import_files(const string &source, string_view message, size_t &versions, size_t &skipped){
+    ThreadPool &pool = maintenance_pool();
+    ImportPlan plan = source.rfind("git:", 0) == 0 ? scan_git_history(source.substr(4))
+                                                   : scan_directory(source, string(message), command_clock, pool);
+    skipped = plan.skipped;
+    size_t n = import_plan(plan, pool, versions);
+    if(wal != nullptr) checkpoint();
+    return n;
+}
+
+// How much a command prints back
+// NORMAL: everything (default); QUIET: no re-printing of content after INSERT/UPDATE/ROLLBACK;
+// SUMMARY: mutations print nothing, a command/error count is printed at the end
+enum class OutputLevel { NORMAL, QUIET, SUMMARY };
+
+// State of one command stream (the console, or a replayed script)
+struct Session
+{
+    OutputSink &out; // Command output
+    OutputSink &err; // Error messages
+    bool batch; // Batch mode: output is only flushed when the buffer fills or at exit
+    bool replay = false; // Replaying the WAL: keep the recorded timestamps, log nothing
+    OutputLevel level;
+    size_t commands = 0; // Commands run
+    size_t errors = 0; // Commands that failed
+    bool in_transaction = false; // Between BEGIN and COMMIT / ABORT
+    vector<string> transaction; // Changes queued since BEGIN, as command lines
+    Session(OutputSink &o, OutputSink &e, bool batch_mode = false, OutputLevel lvl = OutputLevel::NORMAL)
+        : out(o), err(e), batch(batch_mode), level(lvl) {}
+};
+
+// Commands that add files or read every file, and so need the file set to themselves
+bool needs_whole_repository(Command cmd){
+    return cmd == Command::CREATE || cmd == Command::LOAD || cmd == Command::SAVE || cmd == Command::CHECKPOINT
+        || cmd == Command::IMPORT || cmd == Command::GC || cmd == Command::PRUNE || cmd == Command::COMMIT
+        || cmd == Command::SNAPSHOT_ALL;
+}
+
+// Commands the lock-free queries must not overlap (see rewrite_mutex)
+bool rewrites_snapshots(Command cmd){
+    return cmd == Command::GC || cmd == Command::PRUNE || cmd == Command::COMMIT;
+}
+
+// Queries served from a file's published state (see FileHead)
+bool is_file_query(Command cmd){
+    return cmd == Command::READ || cmd == Command::HISTORY || cmd == Command::COMMON_ANCESTOR;
+}
+
+// Locks held by one command. They are kept until its WAL record has been appended, so the
+// log orders conflicting commands the way they ran. Commands on existing files share the
+// file set; changes also lock their file, so commands on different files run in parallel.
+// Queries on a file (READ, HISTORY, COMMON_ANCESTOR) neither hold the file set nor lock the
+// file: they find it through the lock-free index and read its published state, so CREATE,
+// SAVE, SNAPSHOT_ALL and changes to the same file never hold them up. They only wait, through
+// a shared hold of rewrite_mutex, for GC, PRUNE, COMMIT and slices of the cold sweep. DIFF,
+// which reads arbitrary versions, locks the file like a change. Output is only buffered while
+// locks are held.
+struct CommandLocks
+{
+    shared_lock<shared_mutex> files_read;
+    unique_lock<shared_mutex> files_write;
+    shared_lock<shared_mutex> rewrites_read;
+    unique_lock<shared_mutex> rewrites_write;
+    unique_lock<File::mutex_type> file_write;
+
+    explicit CommandLocks(Command cmd){
+        if(is_file_query(cmd)) rewrites_read = shared_lock<shared_mutex>(rewrite_mutex);
+        else if(needs_whole_repository(cmd)){
+            files_write = unique_lock<shared_mutex>(files_mutex);
+            if(rewrites_snapshots(cmd)) rewrites_write = unique_lock<shared_mutex>(rewrite_mutex);
+        }
+        else files_read = shared_lock<shared_mutex>(files_mutex);
+    }
+
+    void lock_file(const File* f){ file_write = unique_lock<File::mutex_type>(f->mutex()); }
+
+    // Release everything, innermost lock first
+    void release(){
+        file_write = unique_lock<File::mutex_type>();
+        rewrites_write = unique_lock<shared_mutex>();
+        rewrites_read = shared_lock<shared_mutex>();
+        files_write = unique_lock<shared_mutex>();
+        files_read = shared_lock<shared_mutex>();
+    }
+};
+
+// Snapshot the active version of every file that has changes to snapshot, in parallel (one
+// worker per file at a time). The files are batched (see File::begin_batch()), so the workers
+// never contend for the rankings: those are re-keyed in one pass at the end. Needs the file set
+// locked exclusively. Returns the number of files snapshotted.
+size_t snapshot_all(string_view message){
+    vector<File*> dirty;
+    for(uint32_t i = 0; i < file_pool.size(); ++i){
+        if(!file_pool[i].active_is_snapshot()) dirty.push_back(&file_pool[i]);
+    }
+    Timestamp clock = command_clock;
+    maintenance_pool().parallel_for(dirty.size(), [&](size_t i){
+        command_clock = clock; // This worker's clock
+        dirty[i]->begin_batch();
+        dirty[i]->snapshot(message);
+    });
+    for(File* f : dirty) f->end_batch();
+    return dirty.size();
+}
+
+// Apply the changes of a transaction (INSERT / UPDATE / SNAPSHOT command lines) as one unit. They
+// are all checked before any is applied, so either every change is made or none is: only a
+// SNAPSHOT of a version that is already a snapshot can fail. Needs the file set locked
+// exclusively, so no reader sees part of the transaction; each file changed is published and
+// re-ranked once, at the end. Returns the number of files changed.
+size_t apply_transaction(const vector<string> &changes){
+    struct Change { Command cmd; File* file; string_view arg; };
+    vector<Change> plan;
+    vector<File*> touched;
+    unordered_map<File*, bool> snapshotted; // Whether a file's active version is a snapshot after the changes so far
+    for(const string &line : changes){
+        CommandLine c = tokenize(line);
+        File* f = c.size() > 1 ? all_files.find(c[1]) : nullptr;
+        if(f == nullptr) throw runtime_error("Transaction aborted: file not found: " + (c.size() > 1 ? string(c[1]) : string()));
+        auto it = snapshotted.find(f);
+        if(it == snapshotted.end()){
+            it = snapshotted.emplace(f, f->active_is_snapshot()).first;
+            touched.push_back(f);
+        }
+        Command cmd = lookup_command(c[0]);
+        if(cmd == Command::SNAPSHOT){
+            if(it->second) throw runtime_error("Transaction aborted: nothing to snapshot in file '" + f->name() + "'");
+            it->second = true;
+        }
+        else it->second = false;
+        plan.push_back(Change{cmd, f, c.size() == 3 ? c[2] : string_view()});
+    }
+    for(File* f : touched) f->begin_batch();
+    for(const Change &c : plan){
+        if(c.cmd == Command::INSERT) c.file->insert(c.arg);
+        else if(c.cmd == Command::UPDATE) c.file->update(c.arg);
+        else c.file->snapshot(c.arg);
+    }
+    for(File* f : touched) f->end_batch();
+    return touched.size();
+}
+
+// Run one tokenized command. Returns false when the session should end (EXIT).
+bool is_logged(Command cmd);
+bool run_command(const CommandLine &command, Session &session){
+    OutputSink &out = session.out;
+    bool echo = session.level == OutputLevel::NORMAL; // Re-print content after changes
+    bool report = session.level != OutputLevel::SUMMARY; // Print confirmations of changes
+    ++session.commands;
+    if(!session.replay) command_clock = clock_now();
+
+            Command cmd = lookup_command(command[0]);
+            CommandTimer timer(cmd);
+            CommandLocks locks(cmd);
+            bool log_command = is_logged(cmd);
+            string record; // WAL record, when it is not the command line itself
+            if(session.in_transaction && (log_command || cmd == Command::LOAD || cmd == Command::IMPORT) && cmd != Command::INSERT
+               && cmd != Command::UPDATE && cmd != Command::SNAPSHOT && cmd != Command::COMMIT) {
+                throw invalid_argument(string(command[0]) + " cannot be used inside a transaction");
+            }
+            // A replica's state only changes through its primary
+            if(replica_link != nullptr && !session.replay && (log_command || cmd == Command::LOAD || cmd == Command::IMPORT || cmd == Command::CHECKPOINT
+               || cmd == Command::BEGIN)) {
+                throw runtime_error("Read-only replica: " + string(command[0]) + " must be sent to the primary (" + replica_link->primary() + ")");
+            }
+            // Replicas replay command lines, which cannot carry files read from the primary's disk
+            if(replication != nullptr && (cmd == Command::LOAD || cmd == Command::IMPORT)) {
+                throw runtime_error(string(command[0]) + " cannot be replicated; start the primary with --load instead");
+            }
+            switch(cmd){
+
+            // HELP: show usage
+            case Command::HELP:
+                out << "Available commands:\n"
+                    << "  CREATE <filename>\n"
+                    << "  READ <filename> [offset length]\n"
+                    << "  INSERT <filename> <content...>\n"
+                    << "  UPDATE <filename> <content...>\n"
+                    << "  SNAPSHOT <filename> [message...]\n"
+                    << "  SNAPSHOT_ALL [message...]\n"
+                    << "  ROLLBACK <filename> [version_id]\n"
+                    << "  HISTORY <filename> [n [cursor]]\n"
+                    << "  COMMON_ANCESTOR <filename> <version_id> <version_id>\n"
+                    << "  DIFF <filename> <version_id> <version_id> [lines|bytes]\n"
+                    << "  BRANCH <filename> <name> [version_id]\n"
+                    << "  TAG <filename> <name> [version_id]\n"
+                    << "  CHECKOUT <filename> <name | version_id>\n"
+                    << "  REFS <filename>\n"
+                    << "  GC [filename]\n"
+                    << "  PRUNE <filename> <n>\n"
+                    << "  STATS\n"
+                    << "  SEARCH <pattern> [filename]\n"
+                    << "  BEGIN / COMMIT / ABORT\n"
+                    << "  RECENT_FILES [k]\n"
+                    << "  BIGGEST_TREES [k]\n"
+                    << "  SAVE <path>\n"
+                    << "  LOAD <path>\n"
+                    << "  CHECKPOINT\n"
+                    << "  IMPORT <directory | git:repository> [message...]\n"
+                    << "  BATCH [normal|quiet|summary|off]\n"
+                    << "  HELP\n"
+                    << "  EXIT\n";
+                out << '\n';
+                break;
+
+            // EXIT: terminate program
+            case Command::EXIT:
+                out << "Exiting..." << '\n';
+                return false;
+
+            // BATCH [level]: switch to buffered batch output at the given level, or back to interactive with "off"
+            case Command::BATCH: {
+                string_view arg = command.size() > 1 ? command[1] : "normal";
+                if(command.size() > 2) throw invalid_argument("BATCH command takes at most one argument");
+                if(arg == "off"){
+                    session.batch = false;
+                    session.level = OutputLevel::NORMAL;
+                    out << "[BATCH] Interactive mode" << '\n';
+                }
+                else{
+                    if(arg == "normal") session.level = OutputLevel::NORMAL;
+                    else if(arg == "quiet") session.level = OutputLevel::QUIET;
+                    else if(arg == "summary") session.level = OutputLevel::SUMMARY;
+                    else throw invalid_argument("BATCH level must be normal, quiet, summary or off");
+                    session.batch = true;
+                    out << "[BATCH] Batch mode, output level: " << arg << '\n';
+                }
+                out << '\n';
+                break;
+            }
+
+            // SAVE <path>: write all files and their versions to a repository file
+            case Command::SAVE: {
+                if(command.size() < 2) throw invalid_argument("SAVE command requires a path");
+                size_t n = save_repository(string(command[1]));
+                if(report){
+                    out << "[SAVE] Saved " << n << " file(s) to '" << command[1] << "'" << '\n';
+                    out << '\n';
+                }
+                break;
+            }
+
+            // LOAD <path>: load files from a repository file written by SAVE
+            case Command::LOAD: {
+                if(command.size() < 2) throw invalid_argument("LOAD command requires a path");
+                size_t n = load_repository(string(command[1]));
+                // Not logged: with a WAL the result is checkpointed right away, so recovery never
+                // re-reads a file that may have changed or gone since
+                if(wal != nullptr) checkpoint();
+                if(report){
+                    out << "[LOAD] Loaded " << n << " file(s) from '" << command[1] << "'" << '\n';
+                    out << '\n';
+                }
+                break;
+            }
+
+            // CHECKPOINT: compact the write-ahead log into the checkpoint file
+            case Command::CHECKPOINT: {
+                checkpoint();
+                if(report){
+                    out << "[CHECKPOINT] Write-ahead log compacted into '" << checkpoint_path << "'" << '\n';
+                    out << '\n';
+                }
+                break;
+            }
+
+            // STATS: command counters and latencies, and what the repository holds
+            case Command::STATS:
+                print_stats(out, gather_stats());
+                break;
+
+            // BEGIN: queue the following INSERT / UPDATE / SNAPSHOT commands until COMMIT or ABORT
+            case Command::BEGIN:
+                if(session.in_transaction) throw runtime_error("A transaction is already open");
+                session.in_transaction = true;
+                if(report) out << "[BEGIN] Transaction started" << '\n' << '\n';
+                break;
+
+            // COMMIT: apply the queued changes as one unit, with one timestamp and one log record
+            // ("COMMIT" followed by the changes, one per line)
+            case Command::COMMIT: {
+                if(!session.in_transaction) throw runtime_error("No transaction is open");
+                vector<string> changes;
+                changes.swap(session.transaction);
+                session.in_transaction = false;
+                size_t files = apply_transaction(changes);
+                record = "COMMIT";
+                for(const string &line : changes){ record += '\n'; record += line; }
+                log_command = !changes.empty();
+                if(report) out << "[COMMIT] Applied " << changes.size() << " change(s) to " << files << " file(s)." << '\n' << '\n';
+                break;
+            }
+
+            // ABORT: drop the queued changes
+            case Command::ABORT:
+                if(!session.in_transaction) throw runtime_error("No transaction is open");
+                if(report) out << "[ABORT] Discarded " << session.transaction.size() << " change(s)." << '\n' << '\n';
+                session.transaction.clear();
+                session.in_transaction = false;
+                break;
+
+            // SEARCH <pattern> [filename]: versions of every file (or of one) whose content contains pattern
+            case Command::SEARCH: {
+                if(command.size() < 2) throw invalid_argument("SEARCH command requires a pattern");
+                string_view pattern = command[1];
+                File* only = nullptr;
+                if(command.size() == 3){
+                    only = all_files.find(command[2]);
+                    if(only == nullptr) throw runtime_error("File not found");
+                }
+                size_t files = 0, versions = 0;
+                out << "[SEARCH] Versions containing '" << pattern << "':" << '\n';
+                auto search = [&](File &f){
+                    lock_guard<File::mutex_type> lk(f.mutex());
+                    vector<uint32_t> ids = f.search(pattern);
+                    if(ids.empty()) return;
+                    ++files;
+                    versions += ids.size();
+                    out << f.name() << ": ";
+                    print_id_ranges(out, ids);
+                    out << '\n';
+                };
+                if(only != nullptr) search(*only);
+                else for(uint32_t i = 0; i < file_pool.size(); ++i) search(file_pool[i]);
+                if(files == 0) out << "(no matches)" << '\n';
+                else out << "Found in " << versions << " version(s) of " << files << " file(s)." << '\n';
+                out << '\n';
+                break;
+            }
+
+            // SNAPSHOT_ALL [message]: snapshot every file with unsnapshotted changes
+            case Command::SNAPSHOT_ALL: {
+                string_view message; // Everything after the command word
+                if(command.size() == 2) message = command[1];
+                else if(command.size() == 3) message = string_view(command[1].data(), command[2].data() + command[2].size() - command[1].data());
+                size_t n = snapshot_all(message);
+                if(report){
+                    out << "[SNAPSHOT_ALL] Snapshot created for " << n << " file(s)." << '\n';
+                    if(!message.empty() && n > 0) out << "Message: " << message << '\n';
+                    out << '\n';
+                }
+                break;
+            }
+
+            // IMPORT <source> [message]: create files from a directory tree or a Git repository's history
+            case Command::IMPORT: {
+                if(command.size() < 2) throw invalid_argument("IMPORT command requires a directory or git:<repository>");
+                string_view message = command.size() == 3 ? command[2] : "Imported";
+                size_t versions = 0, skipped = 0;
+                size_t n = import_files(string(command[1]), message, versions, skipped);
+                if(report){
+                    out << "[IMPORT] Imported " << n << " file(s) with " << versions << " version(s) from '" << command[1] << "'" << '\n';
+                    if(skipped > 0) out << "Skipped " << skipped << " path(s) containing whitespace" << '\n';
+                    out << '\n';
+                }
+                break;
+            }
+
+            // GC [filename]: drop versions no branch, tag or active version leads to
+            // PRUNE <filename> <n>: also drop all but the last n snapshots above each of them
+            case Command::GC: case Command::PRUNE: {
+                if(cmd == Command::PRUNE && command.size() < 2) throw invalid_argument("PRUNE command requires a file name");
+                if(command.size() >= 2){
+                    size_t keep = SIZE_MAX;
+                    if(cmd == Command::PRUNE){
+                        if(command.size() < 3 || !is_nonneg_integer(command[2])) throw invalid_argument("PRUNE requires a non-negative integer count");
+                        keep = to_int(command[2]);
+                    }
+                    else if(command.size() > 2) throw invalid_argument("GC command takes at most one file name");
+                    File* z = all_files.find(command[1]);
+                    if(z == nullptr) throw runtime_error("File not found");
+                    size_t dropped = z->prune(keep);
+                    if(report){
+                        out << "[" << command[0] << "] Pruned " << dropped << " version(s) of file '" << command[1] << "'";
+                        if(cmd == Command::PRUNE) out << ", keeping " << keep << " snapshot(s) per branch";
+                        out << "." << '\n' << '\n';
+                    }
+                    break;
+                }
+                // Every file: GC_BATCH files at a time, pruned in parallel under one hold of the file
+                // set, with a log record per file ("GC <filename>"), so other commands run between
+                // batches instead of waiting for all of it
+                log_command = false;
+                size_t files = file_pool.size(), dropped = 0;
+                locks.release();
+                for(size_t i = 0; i < files; i += GC_BATCH){
+                    unique_lock<shared_mutex> whole(files_mutex);
+                    unique_lock<shared_mutex> rewriting(rewrite_mutex);
+                    size_t n = min(GC_BATCH, files - i);
+                    vector<size_t> counts(n);
+                    maintenance_pool().parallel_for(n, [&](size_t k){ counts[k] = file_pool[i + k].prune(); });
+                    for(size_t k = 0; k < n; ++k){
+                        dropped += counts[k];
+                        if((wal != nullptr || replication != nullptr) && !session.replay) log_change("GC " + file_pool[i + k].name());
+                    }
+                }
+                if(report) out << "[GC] Pruned " << dropped << " version(s) across " << files << " file(s)." << '\n' << '\n';
+                break;
+            }
+
+            // CREATE <filename>: create a new file
+            case Command::CREATE: {
+                if(command.size() < 2) throw std::invalid_argument("CREATE command requires a file name");
+                string_view name = command[1];
+                if(name.empty()) throw invalid_argument("File name cannot be empty");
+                uint64_t h = FileIndex::hash_name(name);
+                if(all_files.find(name, h) != nullptr) throw invalid_argument("File already exists");
+                File* f = file_pool.emplace_back(string(name), all_files.size(), &rankings);
+                all_files.insert(name, h, f);
+
+                if(report){
+                    out << "[CREATE] File created: " << name << '\n';
+                    out << '\n';
+                }
+                break;
+            }
+
+            // RECENT_FILES: list files by most recent modification
+            case Command::RECENT_FILES: {
+                lock_guard<mutex> ranked(rankings.lock);
+                int num = rankings.recent.size();
+                if(command.size() > 1) {
+                    if(!is_nonneg_integer(command[1])) throw invalid_argument("RECENT_FILES requires a non-negative integer argument");
+                    num = to_int(command[1]);
+                }
+                if(num > (int)rankings.recent.size()) throw invalid_argument("RECENT_FILES: requested number exceeds total files");
+                out << "[RECENT_FILES] Showing " << num << " file(s):" << '\n';
+                TimeFormatter format;
+                rankings.recent.top(num, [&](File* f, Timestamp ts) {
+                    out << f->name() << " -> " << format(ts) << '\n';
+                });
+                out << '\n';
+                break;
+            }
+
+            // BIGGEST_TREES: list files by number of versions (largest first)
+            case Command::BIGGEST_TREES: {
+                lock_guard<mutex> ranked(rankings.lock);
+                int num = rankings.biggest.size();
+                if(command.size() > 1) {
+                    if(!is_nonneg_integer(command[1])) throw invalid_argument("BIGGEST_TREES requires a non-negative integer argument");
+                    num = to_int(command[1]);
+                }
+                if(num > (int)rankings.biggest.size()) throw invalid_argument("BIGGEST_TREES: requested number exceeds total files");
+                out << "[BIGGEST_TREES] Showing " << num << " file(s) by version count:" << '\n';
+                rankings.biggest.top(num, [&](File* f, int versions) {
+                    out << f->name() << " -> " << versions << '\n';
+                });
+                out << '\n';
+                break;
+            }
+
+            // File-specific commands: READ, INSERT, UPDATE, SNAPSHOT, ROLLBACK, HISTORY, COMMON_ANCESTOR, DIFF,
+            // BRANCH, TAG, CHECKOUT, REFS
+            case Command::READ: case Command::INSERT: case Command::UPDATE:
+            case Command::SNAPSHOT: case Command::ROLLBACK: case Command::HISTORY:
+            case Command::COMMON_ANCESTOR: case Command::DIFF:
+            case Command::BRANCH: case Command::TAG: case Command::CHECKOUT: case Command::REFS: {
+                if(command.size() < 2) throw invalid_argument("Command requires a file name");
+
+                string_view name = command[1];
+                if(name.empty()) throw invalid_argument("File name cannot be empty");
+                File* z = all_files.find(name);
+                if(z == nullptr) throw runtime_error("File not found");
+
+                // Inside a transaction, changes are queued for COMMIT
+                if(session.in_transaction && (cmd == Command::INSERT || cmd == Command::UPDATE || cmd == Command::SNAPSHOT)){
+                    string line(command[0]);
+                    for(int t = 1; t < command.count; ++t){ line += ' '; line.append(command[t]); }
+                    session.transaction.push_back(std::move(line));
+                    log_command = false;
+                    if(report){
+                        out << "[" << command[0] << "] Queued for file '" << name << "' (" << session.transaction.size() << " change(s) in transaction)" << '\n';
+                        out << '\n';
+                    }
+                    break;
+                }
+                if(!is_file_query(cmd)) locks.lock_file(z);
+
+                // READ <filename> [offset length]: print file content, or length bytes of it from offset
+                if(cmd == Command::READ){
+                    if(command.size() == 3){
+                        CommandLine range = tokenize(command[2]);
+                        if(range.size() != 2 || !is_nonneg_integer(range[0]) || !is_nonneg_integer(range[1])) {
+                            throw invalid_argument("READ range requires a non-negative integer offset and length");
+                        }
+                        size_t offset = stoull(string(range[0])), len = stoull(string(range[1]));
+                        ContentView part = z->read_view(offset, len);
+                        out << "[READ] Bytes " << offset << ".." << offset + part.size() << " of file '" << name << "':\n";
+                        out << part << '\n';
+                    }
+                    else{
+                        out << "[READ] Content of file '" << name << "':\n";
+                        out << z->read_view() << '\n';
+                    }
+                    out << '\n';
+                }
+
+                // INSERT <filename> <content>: append content to file
+                else if(cmd == Command::INSERT){
+                    string_view content = (command.size() == 2) ? "" : command[2];
+                    z->insert(content);
+                    if(echo){
+                        out << "[INSERT] Content inserted into file '" << name << "':\n" << content << '\n';
+                        out << "Current content:\n" << z->read_view() << '\n';
+                        out << '\n';
+                    }
+                    else if(report){
+                        out << "[INSERT] Content inserted into file '" << name << "'." << '\n';
+                        out << '\n';
+                    }
+                }
+
+                // UPDATE <filename> <content>: replace file content
+                else if(cmd == Command::UPDATE){
+                    string_view content = (command.size() == 2) ? "" : command[2];
+                    z->update(content);
+                    if(echo){
+                        out << "[UPDATE] Content updated in file '" << name << "':\n" << content << '\n';
+                        out << "Current content:\n" << z->read_view() << '\n';
+                        out << '\n';
+                    }
+                    else if(report){
+                        out << "[UPDATE] Content updated in file '" << name << "'." << '\n';
+                        out << '\n';
+                    }
+                }
+
+                // SNAPSHOT <filename> <message>: create a snapshot with optional message
+                else if(cmd == Command::SNAPSHOT){
+                    string_view message = (command.size() == 2) ? "" : command[2];
+                    z->snapshot(message);
+                    if(report){
+                        out << "[SNAPSHOT] Snapshot created for file '" << name << "'." << '\n';
+                        if(!message.empty()) out << "Message: " << message << '\n';
+                        out << '\n';
+                    }
+                }
+
+                // ROLLBACK <filename> [version_id]: rollback to previous version or to given version id
+                else if(cmd == Command::ROLLBACK){
+                    if(command.size() > 3) throw invalid_argument("ROLLBACK command takes at most one argument");
+                    if(command.size() == 2){
+                        z->rollback();
+                        if(report) out << "[ROLLBACK] File '" << name << "' rolled back to previous version." << '\n';
+                    }
+                    else{
+                        if(!is_nonneg_integer(command[2])) throw invalid_argument("ROLLBACK requires a non-negative integer version id");
+                        int ver = to_int(command[2]);
+                        z->rollback(ver);
+                        if(report) out << "[ROLLBACK] File '" << name << "' rolled back to version " << ver << "." << '\n';
+                    }
+                    if(echo) out << "Current content:\n" << z->read_view() << '\n';
+                    if(report) out << '\n';
+                }
+
+                // HISTORY <filename> [n [cursor]]: print all (or the last n) snapshots for the file;
+                // with a cursor, the n before it (the page the previous HISTORY pointed to)
+                else if(cmd == Command::HISTORY){
+                    CommandLine args = command.size() == 3 ? tokenize(command[2]) : CommandLine();
+                    if(args.size() > 2) throw invalid_argument("HISTORY takes at most a count and a cursor");
+                    size_t limit = SIZE_MAX;
+                    uint32_t cursor = NO_VERSION, next = NO_VERSION;
+                    if(args.size() >= 1){
+                        if(!is_nonneg_integer(args[0])) throw invalid_argument("HISTORY requires a non-negative integer count");
+                        limit = to_int(args[0]);
+                    }
+                    if(args.size() == 2){
+                        if(!is_nonneg_integer(args[1])) throw invalid_argument("HISTORY requires a non-negative integer cursor");
+                        cursor = to_int(args[1]);
+                        if(!z->has_version(cursor)) throw out_of_range("Invalid version id");
+                    }
+                    out << "[HISTORY] Snapshots for file '" << name << "':" << '\n';
+                    int cnt = z->history(out, limit, cursor, &next);
+                    if(cnt == 0){
+                        out << (cursor == NO_VERSION ? "(no snapshots yet)" : "(no earlier snapshots)") << '\n';
+                    }
+                    if(next != NO_VERSION) out << "Next page: HISTORY " << name << ' ' << limit << ' ' << next << '\n';
+                    out << '\n';
+                }
+
+                // COMMON_ANCESTOR <filename> <a> <b>: latest version both a and b descend from
+                else if(cmd == Command::COMMON_ANCESTOR){
+                    CommandLine ids = command.size() == 3 ? tokenize(command[2]) : CommandLine();
+                    if(ids.size() != 2) throw invalid_argument("COMMON_ANCESTOR requires two version ids");
+                    if(!is_nonneg_integer(ids[0]) || !is_nonneg_integer(ids[1])) {
+                        throw invalid_argument("COMMON_ANCESTOR requires non-negative integer version ids");
+                    }
+                    int a = to_int(ids[0]), b = to_int(ids[1]);
+                    int c = z->common_ancestor(a, b);
+                    out << "[COMMON_ANCESTOR] Versions " << a << " and " << b << " of file '" << name
+                        << "' share ancestor version " << c << "." << '\n';
+                    out << '\n';
+                }
+
+                // DIFF <filename> <a> <b> [lines|bytes]: changes turning version a into version b
+                else if(cmd == Command::DIFF){
+                    CommandLine args = command.size() == 3 ? tokenize(command[2]) : CommandLine();
+                    if(args.size() < 2) throw invalid_argument("DIFF requires two version ids");
+                    if(!is_nonneg_integer(args[0]) || !is_nonneg_integer(args[1])) {
+                        throw invalid_argument("DIFF requires non-negative integer version ids");
+                    }
+                    bool by_line = true;
+                    if(args.size() == 3){
+                        if(args[2] == "bytes") by_line = false;
+                        else if(args[2] != "lines") throw invalid_argument("DIFF mode must be 'lines' or 'bytes'");
+                    }
+                    int a = to_int(args[0]), b = to_int(args[1]);
+                    string ca = z->read_version(a), cb = z->read_version(b);
+                    out << "[DIFF] File '" << name << "': version " << a << " -> version " << b
+                        << (by_line ? " (lines)" : " (bytes)") << '\n';
+                    DiffStats st = write_diff(ca, cb, by_line, out, z->shared_prefix(a, b));
+                    if(st.hunks == 0) out << "(no differences)" << '\n';
+                    else out << st.hunks << " hunk(s), -" << st.removed << " +" << st.added << (by_line ? " line(s)" : " byte(s)") << '\n';
+                    out << '\n';
+                }
+
+                // BRANCH / TAG <filename> <name> [version_id]: name a version (default: the active one)
+                else if(cmd == Command::BRANCH || cmd == Command::TAG){
+                    const char* what = cmd == Command::BRANCH ? "BRANCH" : "TAG";
+                    CommandLine args = command.size() == 3 ? tokenize(command[2]) : CommandLine();
+                    if(args.size() == 0) throw invalid_argument(string(what) + " requires a name");
+                    if(args.size() == 3) throw invalid_argument(string(what) + " takes a name and at most one version id");
+                    if(is_nonneg_integer(args[0])) throw invalid_argument("Ref name cannot be a number");
+                    int ver = -1;
+                    if(args.size() == 2){
+                        if(!is_nonneg_integer(args[1])) throw invalid_argument(string(what) + " requires a non-negative integer version id");
+                        ver = to_int(args[1]);
+                    }
+                    z->add_ref(args[0], cmd == Command::BRANCH ? RefKind::BRANCH : RefKind::TAG, ver);
+                    if(report){
+                        const Ref &r = z->ref_table()[z->ref_table().size() - 1];
+                        out << "[" << what << "] " << (cmd == Command::BRANCH ? "Branch '" : "Tag '") << r.name
+                            << "' created at version " << r.target << " of file '" << name << "'." << '\n';
+                        out << '\n';
+                    }
+                }
+
+                // CHECKOUT <filename> <name | version_id>: make a ref's (or a version's) version active
+                else if(cmd == Command::CHECKOUT){
+                    CommandLine args = command.size() == 3 ? tokenize(command[2]) : CommandLine();
+                    if(args.size() != 1) throw invalid_argument("CHECKOUT requires a ref name or version id");
+                    if(is_nonneg_integer(args[0])){
+                        int ver = to_int(args[0]);
+                        z->checkout(ver);
+                        if(report) out << "[CHECKOUT] File '" << name << "' checked out at version " << ver << "." << '\n';
+                    }
+                    else{
+                        const Ref &r = z->checkout(args[0]);
+                        if(report){
+                            out << "[CHECKOUT] File '" << name << "' checked out " << (r.kind == RefKind::BRANCH ? "branch '" : "tag '")
+                                << r.name << "' at version " << r.target << "." << '\n';
+                        }
+                    }
+                    if(echo) out << "Current content:\n" << z->read_view() << '\n';
+                    if(report) out << '\n';
+                }
+
+                // REFS <filename>: list branches and tags, marking the checked-out branch with '*'
+                else if(cmd == Command::REFS){
+                    const RefTable &refs = z->ref_table();
+                    out << "[REFS] Refs of file '" << name << "':" << '\n';
+                    for(uint32_t i = 0; i < refs.size(); ++i){
+                        out << (i == z->checked_out() ? "* " : "  ") << (refs[i].kind == RefKind::BRANCH ? "branch " : "tag ")
+                            << refs[i].name << " -> version " << refs[i].target << '\n';
+                    }
+                    if(refs.empty()) out << "(no refs yet)" << '\n';
+                    out << '\n';
+                }
+                break;
+            }
+
+            // Unknown command handler
+            default:
+                throw invalid_argument("Unknown command: " + string(command[0]));
+            }
+
+    // Log state changes once they have succeeded
+    if((wal != nullptr || replication != nullptr) && !session.replay && log_command){
+        if(record.empty()){
+            record = command[0];
+            for(int t = 1; t < command.count; ++t){ record += ' '; record.append(command[t]); }
+        }
+        log_change(record);
+        locks.release();
+        if(wal != nullptr && wal->size() > checkpoint_bytes){
+            unique_lock<shared_mutex> whole(files_mutex);
+            if(wal->size() > checkpoint_bytes) checkpoint(); // Unless another thread got there first
+        }
+    }
+    if(!session.replay){
+        locks.release();
+        sweep_cold();
+    }
+    return true;
+}
+
+// Commands whose effect must survive a restart
+bool is_logged(Command cmd){
+    switch(cmd){
+        case Command::CREATE: case Command::INSERT: case Command::UPDATE:
+        case Command::SNAPSHOT: case Command::ROLLBACK:
+        case Command::BRANCH: case Command::TAG: case Command::CHECKOUT:
+        case Command::GC: case Command::PRUNE: case Command::COMMIT: case Command::SNAPSHOT_ALL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Apply one logged change (a WAL record, or one streamed by the primary) in a replay session,
+// with the timestamp it was made at. Returns whether it succeeded.
+bool apply_change(Session &session, int64_t ts, string_view payload){
+    command_clock = ts;
+    clock_observe(ts);
+    try {
+        // A transaction is logged as "COMMIT" followed by its changes, one per line
+        size_t eol = payload.find('\n');
+        if(eol != string_view::npos){
+            session.in_transaction = true;
+            session.transaction.clear();
+            for(size_t at = eol + 1; at <= payload.size(); ){
+                size_t end = min(payload.find('\n', at), payload.size());
+                session.transaction.emplace_back(payload.substr(at, end - at));
+                at = end + 1;
+            }
+            payload = payload.substr(0, eol);
+        }
+        CommandLine command = tokenize(payload);
+        if(!command.empty()) run_command(command, session);
+    } catch(const exception &) {
+        return false;
+    }
+    return true;
+}
+
+// Rebuild state after a restart: load the checkpoint, then replay the WAL records after it.
+// Returns the last WAL sequence number applied; failed counts the records that did not apply.
+uint64_t recover(const string &wal_path, size_t &replayed, size_t &failed){
+    uint64_t seq = 0;
+    FILE* probe = fopen(checkpoint_path.c_str(), "rb");
+    if(probe != nullptr){
+        fclose(probe);
+        shared_ptr<const RepoImage> image = make_shared<RepoImage>(checkpoint_path);
+        seq = image->header().wal_seq;
+        load_image(image);
+    }
+    OutputSink discard(-1);
+    Session session(discard, discard, true, OutputLevel::SUMMARY);
+    session.replay = true;
+    replayed = failed = 0;
+    seq = WriteAheadLog::replay(wal_path, seq, [&](uint64_t, int64_t ts, string_view payload) {
+        // Logged commands succeeded originally; a failure means the log does not fit the checkpoint
+        if(!apply_change(session, ts, payload)) ++failed;
+        ++replayed;
+    });
+    command_clock = 0;
+    return seq;
+}
+
+// Follow the primary: apply the changes it streams until the connection ends
+void follow_primary(){
+    OutputSink discard(-1);
+    Session session(discard, discard, true, OutputLevel::SUMMARY);
+    session.replay = true;
+    try {
+        replica_link->run([&](int64_t ts, string_view payload){ return apply_change(session, ts, payload); });
+    } catch(const exception &e) {
+        cerr << "Error: " << e.what() << endl;
+    }
+}
+
+// Read commands from in_fd until EOF or EXIT, reporting errors without stopping
+void run_session(int in_fd, Session &session){
+    LineReader reader(in_fd);
+    string_view input;
+    while (true)
+    {
+        try {
+            // Read user input (command)
+            if(!reader.next(input)) {
+                // Graceful exit on EOF (e.g., Ctrl+Z in Windows console)
+                break;
+            }
+            CommandLine command = tokenize(input);
+
+            if (command.empty()) continue;
+
+            if(!run_command(command, session)) break;
+
+    } catch(const exception& e) {
+            ++session.errors;
+            // Keep stdout and stderr in order when both go to the console
+            if(!session.batch) session.out.flush();
+            session.err << "Error: " << e.what() << '\n';
+            session.err.flush();
+            session.out << '\n';
+        }
+        // Batch output goes out in large blocks (server sessions buffer without a limit, so
+        // the blocks are cut here, outside any lock)
+        if(!session.batch || session.out.pending() >= (1 << 20)) session.out.flush();
+    }
+    if(session.level == OutputLevel::SUMMARY){
+        session.out << "[SUMMARY] " << session.commands << " command(s), " << session.errors << " error(s)" << '\n';
+    }
+    session.out.flush();
+}
+
+// Answer HTTP requests on metrics with the Prometheus text format of STATS, one client at a time
+void serve_metrics(unique_ptr<ServerSocket> metrics){
+    while(true){
+        int client = metrics->accept_client();
+        if(client < 0){
+            this_thread::sleep_for(chrono::milliseconds(10));
+            continue;
+        }
+        ServerSocket::set_timeout(client, 5); // A stalled scraper must not hold up the next one
+        LineReader reader(client, 1 << 12);
+        string_view line;
+        while(reader.next(line) && !line.empty() && line != "\r") {} // Any request gets the metrics
+        OutputSink sink(client, SIZE_MAX);
+        sink << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n";
+        {
+            shared_lock<shared_mutex> lk(files_mutex);
+            print_prometheus(sink, gather_stats());
+        }
+        sink.flush();
+        ServerSocket::close_client(client);
+    }
+}
+
+// Accept replicas on listener until the process is stopped. Each is sent a snapshot of the
+// repository first, saved to a temporary file under an exclusive hold of the file set, so that
+// no change falls between the snapshot and the changes streamed after it.
+void serve_replicas(unique_ptr<ServerSocket> listener){
+    while(true){
+        int client = listener->accept_client();
+        if(client < 0){
+            this_thread::sleep_for(chrono::milliseconds(10));
+            continue;
+        }
+        ServerSocket::set_timeout(client, 30); // A replica that stops reading is dropped
+        string path = (filesystem::temp_directory_path() / ("vcs-snapshot-" + to_string(clock_now()) + ".repo")).string();
+        try {
+            unique_lock<shared_mutex> whole(files_mutex);
+            save_repository(path);
+            replication->add(client, path);
+        } catch(const exception &e) {
+            remove(path.c_str());
+            ServerSocket::close_client(client);
+            cerr << "Error: " << e.what() << endl;
+        }
+    }
+}
+
+// Server mode: accept clients on address until the process is stopped. Each connection is an
+// interactive session of its own (output and errors go back over the connection) and runs on
+// one of the pool's worker threads; clients beyond the pool size wait for a free worker.
+void serve(const string &address, size_t threads, const string &metrics_address){
+    ServerSocket listener(address);
+    if(!metrics_address.empty()){
+        unique_ptr<ServerSocket> metrics(new ServerSocket(metrics_address));
+        cout << "[SERVER] Metrics on " << (metrics_address.rfind("unix:", 0) == 0 ? metrics_address : "http://127.0.0.1:" + to_string(metrics->port()) + "/metrics") << endl;
+        thread(serve_metrics, std::move(metrics)).detach();
+    }
+    ThreadPool pool(threads);
+    if(address.rfind("unix:", 0) == 0) cout << "[SERVER] Listening on " << address;
+    else cout << "[SERVER] Listening on 127.0.0.1:" << listener.port();
+    cout << " with " << pool.size() << " worker thread(s)" << endl;
+    while(true){
+        int client = listener.accept_client();
+        if(client < 0){
+            // Typically out of descriptors: back off instead of spinning
+            this_thread::sleep_for(chrono::milliseconds(10));
+            continue;
+        }
+        pool.submit([client]{
+            OutputSink sink(client, SIZE_MAX); // Flushed by run_session after each command
+            Session session(sink, sink);
+            run_session(client, session);
+            sink.flush();
+            ServerSocket::close_client(client);
+        });
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool batch = false;
+    OutputLevel level = OutputLevel::NORMAL;
+    string load_path;
+    string wal_path;
+    size_t wal_group_records = 64;
+    unsigned wal_group_ms = 10;
+    string listen_address;
+    string metrics_address;
+    string store_dir;
+    string replicate_address;
+    size_t replicate_batch_records = 64;
+    unsigned replicate_batch_ms = 10;
+    string replica_of;
+    size_t cold_cache_mb = 64;
+    size_t threads = thread::hardware_concurrency() ? thread::hardware_concurrency() : 4;
+
+    // Command-line options
+    for(int a = 1; a < argc; ++a){
+        string opt = argv[a];
+        if(opt == "--hash=fast") blob_store.set_hash_mode(HashMode::FAST);
+        else if(opt == "--hash=sha1") blob_store.set_hash_mode(HashMode::SHA1);
+        else if(opt == "--hash=sha256") blob_store.set_hash_mode(HashMode::SHA256);
+        else if(opt.rfind("--load=", 0) == 0) load_path = opt.substr(7);
+        else if(opt.rfind("--wal=", 0) == 0) wal_path = opt.substr(6);
+        else if(opt.rfind("--wal-group-records=", 0) == 0 && is_nonneg_integer(opt.substr(20))) wal_group_records = stoul(opt.substr(20));
+        else if(opt.rfind("--wal-group-ms=", 0) == 0 && is_nonneg_integer(opt.substr(15))) wal_group_ms = stoul(opt.substr(15));
+        else if(opt.rfind("--checkpoint-bytes=", 0) == 0 && is_nonneg_integer(opt.substr(19))) checkpoint_bytes = stoull(opt.substr(19));
+        else if(opt.rfind("--listen=", 0) == 0) listen_address = opt.substr(9);
+        else if(opt.rfind("--cold-after=", 0) == 0 && is_nonneg_integer(opt.substr(13))) cold_after = stoll(opt.substr(13));
+        else if(opt.rfind("--store=", 0) == 0 && opt.size() > 8) store_dir = opt.substr(8);
+        else if(opt.rfind("--cold-cache=", 0) == 0 && is_nonneg_integer(opt.substr(13))) cold_cache_mb = stoull(opt.substr(13));
+        else if(opt.rfind("--memory-budget=", 0) == 0 && is_nonneg_integer(opt.substr(16))) memory_budget = stoull(opt.substr(16)) << 20;
+        else if(opt.rfind("--metrics=", 0) == 0) metrics_address = opt.substr(10);
+        else if(opt.rfind("--replicate=", 0) == 0) replicate_address = opt.substr(12);
+        else if(opt.rfind("--replicate-batch-records=", 0) == 0 && is_nonneg_integer(opt.substr(26))) replicate_batch_records = stoul(opt.substr(26));
+        else if(opt.rfind("--replicate-batch-ms=", 0) == 0 && is_nonneg_integer(opt.substr(21))) replicate_batch_ms = stoul(opt.substr(21));
+        else if(opt.rfind("--replica-of=", 0) == 0) replica_of = opt.substr(13);
+        else if(opt.rfind("--threads=", 0) == 0 && is_nonneg_integer(opt.substr(10))) threads = stoul(opt.substr(10));
+        else if(opt == "--batch") batch = true;
+        else if(opt == "--quiet"){ batch = true; level = OutputLevel::QUIET; }
+        else if(opt == "--summary"){ batch = true; level = OutputLevel::SUMMARY; }
+        else {
+            cerr << "Error: Unknown option: " << opt << endl;
+            return 1;
+        }
+    }
+
+    // Within a memory budget the cold cache gets at most a quarter of it
+    cold_cache.set_capacity(memory_budget != 0 ? min<size_t>(cold_cache_mb << 20, memory_budget / 4) : cold_cache_mb << 20);
+
+    if(!metrics_address.empty() && listen_address.empty()){
+        cerr << "Error: --metrics requires --listen" << endl;
+        return 1;
+    }
+    if(!replica_of.empty() && (!wal_path.empty() || !load_path.empty() || !replicate_address.empty())){
+        cerr << "Error: --replica-of cannot be combined with --wal, --load or --replicate (a replica's state comes from its primary)" << endl;
+        return 1;
+    }
+#if !VCS_FILE_LOCKS
+    if(!listen_address.empty() || !replicate_address.empty() || !replica_of.empty()){
+        string opt = !listen_address.empty() ? "--listen" : !replicate_address.empty() ? "--replicate" : "--replica-of";
+        cerr << "Error: " << opt << " is not available in a build without file locks (VCS_FILE_LOCKS=0)" << endl;
+        return 1;
+    }
+#endif
+
+    OutputSink out(1, 1 << 20);
+    OutputSink err(2, 1 << 12);
+    Session session(out, err, batch, level);
+    unique_ptr<WriteAheadLog> log;
+    unique_ptr<ReplicationHub> hub;
+    unique_ptr<ReplicaLink> link;
+    thread follower;
+    try {
+        if(!store_dir.empty()) segment_store = make_unique<SegmentStore>(store_dir);
+        if(wal_path.empty()){
+            if(!load_path.empty()) load_repository(load_path);
+        } else {
+            checkpoint_path = wal_path + ".checkpoint";
+            bool had_checkpoint = false;
+            if(FILE* probe = fopen(checkpoint_path.c_str(), "rb")){ fclose(probe); had_checkpoint = true; }
+            size_t replayed = 0, failed = 0;
+            uint64_t seq = recover(wal_path, replayed, failed);
+            // The log and its checkpoint already hold the state; loading on top of them again would clash
+            if(!load_path.empty() && (had_checkpoint || replayed > 0)){
+                throw runtime_error("--load cannot be used with a write-ahead log that already holds changes: " + wal_path);
+            }
+            if(!load_path.empty()) load_repository(load_path);
+            log.reset(new WriteAheadLog(wal_path, seq + 1, wal_group_records, wal_group_ms));
+            wal = log.get();
+            // Not logged, like the LOAD command: the loaded state becomes the checkpoint
+            if(!load_path.empty()) checkpoint();
+            else if(replayed > 0 || all_files.size() > 0){
+                out << "[WAL] Recovered " << all_files.size() << " file(s), replayed " << replayed << " record(s)";
+                if(failed > 0) out << ", " << failed << " of which failed to apply";
+                out << '\n' << '\n';
+                out.flush();
+            }
+        }
+        if(!replicate_address.empty()){
+            unique_ptr<ServerSocket> listener(new ServerSocket(replicate_address));
+            hub.reset(new ReplicationHub(replicate_batch_records, replicate_batch_ms));
+            replication = hub.get();
+            cout << "[REPLICATION] Serving replicas on " << (replicate_address.rfind("unix:", 0) == 0 ? replicate_address : "127.0.0.1:" + to_string(listener->port())) << endl;
+            thread(serve_replicas, std::move(listener)).detach();
+        }
+        if(!replica_of.empty()){
+            link.reset(new ReplicaLink(replica_of));
+            string path = (filesystem::temp_directory_path() / ("vcs-replica-" + to_string(clock_now()) + ".repo")).string();
+            uint64_t seq = link->receive_snapshot(path);
+            try { load_repository(path); } catch(const exception &) { remove(path.c_str()); throw; }
+            remove(path.c_str()); // The loaded image stays mapped
+            replica_link = link.get();
+            out << "[REPLICA] Following " << replica_of << ": " << all_files.size() << " file(s) as of change " << seq << '\n';
+            out << '\n';
+            out.flush();
+            follower = thread(follow_primary);
+        }
+    } catch(const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    if(!listen_address.empty()){
+        try {
+            serve(listen_address, threads, metrics_address);
+        } catch(const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+    }
+    run_session(0, session);
+    if(follower.joinable()){
+        link->stop();
+        follower.join();
+    }
+    replica_link = nullptr;
+    replication = nullptr;
+    wal = nullptr;
+    return 0;
+}
@@ -0,0 +1,535 @@
+//
+// Benchmark suite for the version store.
+//
+// Drives File and FileIndex directly (no command parsing, no terminal output)
+// with synthetic workloads and reports, per operation type, the number of
+// operations, throughput and p50 / p99 latency, followed by the peak resident
+// set size of the process.
+//
+// Workloads:
+//   small_files   many small files: CREATE, a few INSERT/UPDATE/SNAPSHOT, READ, then a parallel
+//                 snapshot of them all (SNAPSHOT_ALL)
+//   huge_files    a few files with large content, edited and snapshotted in place, read whole, as a
+//                 view and by range, and DIFFed
+//   deep_history  one file with a long linear chain of snapshots, full and last-n HISTORY, SEARCH,
+//                 then last-n HISTORY again after PRUNE has dropped all but the last snapshots
+//   wide_branch   one file where every version is branched off the root via ROLLBACK, then GC
+//   skewed_names  log_NNNNN.txt file names looked up with a Zipf-distributed key
+//   shared_file   reader threads doing lock-free READ/HISTORY while a writer changes the same file
+//   append_log    ROLLBACK to an old snapshot, then many INSERTs into the new unsnapshotted version
+//   cold_history  files of line-structured text whose old snapshots are compressed, then read back
+//   spilled_history  the same with a segment store: the old snapshots are moved to disk and read back
+//   policies      the same deep-history and huge-file edits on files built with each storage,
+//                 allocator and locking policy (see storage_policy.h), ops prefixed by policy
+//
+// Usage:
+//   version_control_system_bench.exe [--scale=<n>] [--workload=<name>|all] [--seed=<n>]
+//
+// --scale multiplies the size of every workload (default 1).
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#include "diff.h"
+#include "file_index.h"
+#include "thread_pool.h"
+#include "version_file.h"
+using namespace std;
+
+using bench_clock = chrono::steady_clock;
+
+// Latency samples of one operation type, in nanoseconds
+struct OpStats
+{
+    vector<uint64_t> samples;
+    uint64_t total_ns = 0;
+};
+
+// Timing results of one workload, keyed by operation name
+class Recorder
+{
+    private:
+        map<string, OpStats> ops;
+
+    public:
+        // Run fn once and record its latency under op
+        template <typename Fn>
+        void time(const char* op, Fn fn){
+            bench_clock::time_point t0 = bench_clock::now();
+            fn();
+            uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(bench_clock::now() - t0).count();
+            OpStats &s = ops[op];
+            s.samples.push_back(ns);
+            s.total_ns += ns;
+        }
+
+        // Add the samples of another recorder (e.g. one per thread)
+        void merge(const Recorder &o){
+            for(const auto &kv : o.ops){
+                OpStats &s = ops[kv.first];
+                s.samples.insert(s.samples.end(), kv.second.samples.begin(), kv.second.samples.end());
+                s.total_ns += kv.second.total_ns;
+            }
+        }
+
+        void report(const string &workload){
+            printf("%s\n", workload.c_str());
+            printf("    %-10s %10s %14s %12s %12s\n", "op", "count", "ops/sec", "p50 (us)", "p99 (us)");
+            for(auto &kv : ops){
+                vector<uint64_t> &v = kv.second.samples;
+                sort(v.begin(), v.end());
+                double p50 = v[v.size() / 2] / 1000.0;
+                double p99 = v[min(v.size() - 1, v.size() * 99 / 100)] / 1000.0;
+                double rate = kv.second.total_ns ? v.size() * 1e9 / kv.second.total_ns : 0;
+                printf("    %-10s %10zu %14.0f %12.2f %12.2f\n", kv.first.c_str(), v.size(), rate, p50, p99);
+            }
+        }
+};
+
+// Peak resident set size of this process in KB (0 where not available)
+long peak_rss_kb(){
+#ifndef _WIN32
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF, &ru) == 0){
+#ifdef __APPLE__
+        return ru.ru_maxrss / 1024; // Reported in bytes on macOS
+#else
+        return ru.ru_maxrss;
+#endif
+    }
+#endif
+    return 0;
+}
+
+// Everything a workload operates on; destroyed (files first) when the workload ends
+struct Store
+{
+    FileRankings rankings;
+    FileIndex index{epochs};
+    NodeArena<File> pool;
+    uint64_t next_seq = 0;
+
+    File* create(const string &name){
+        File* f = pool.emplace_back(name, next_seq++, &rankings);
+        index.insert(name, f);
+        return f;
+    }
+};
+
+// Random printable content of length n
+string random_text(mt19937_64 &rng, size_t n){
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789 ";
+    string s(n, ' ');
+    for(char &c : s) c = alphabet[rng() % (sizeof(alphabet) - 1)];
+    return s;
+}
+
+// Many small files, each edited a few times
+void small_files(Recorder &rec, int scale, mt19937_64 &rng){
+    Store st;
+    int n = 20000 * scale;
+    vector<string> names;
+    names.reserve(n);
+    for(int i = 0; i < n; ++i) names.push_back("file_" + to_string(i) + ".txt");
+    for(int i = 0; i < n; ++i) rec.time("create", [&]{ st.create(names[i]); });
+    for(int round = 0; round < 3; ++round){
+        for(int i = 0; i < n; ++i){
+            File* f = st.index.find(names[i]);
+            string text = random_text(rng, 16 + rng() % 48);
+            if(round % 2 == 0) rec.time("insert", [&]{ f->insert(text); });
+            else rec.time("update", [&]{ f->update(text); });
+            rec.time("snapshot", [&]{ f->snapshot("round " + to_string(round)); });
+        }
+    }
+    for(int i = 0; i < n; ++i){
+        File* f = nullptr;
+        const string &name = names[rng() % n];
+        rec.time("lookup", [&]{ f = st.index.find(name); });
+        rec.time("read", [&]{ f->read(); });
+    }
+    OutputSink sink(-1);
+    for(int i = 0; i < n; i += 10){
+        File* f = st.index.find(names[i]);
+        rec.time("history", [&]{ f->history(sink); });
+    }
+    ThreadPool pool(thread::hardware_concurrency() ? thread::hardware_concurrency() : 4);
+    for(int round = 0; round < 5; ++round){
+        for(int i = 0; i < n; ++i) st.index.find(names[i])->insert(random_text(rng, 32));
+        rec.time("snapshot_all", [&]{
+            pool.parallel_for(n, [&](size_t i){
+                File* f = st.index.find(names[i]);
+                f->begin_batch();
+                f->snapshot();
+            });
+            for(int i = 0; i < n; ++i) st.index.find(names[i])->end_batch();
+        });
+    }
+}
+
+// A few files with large content, edited near the end and snapshotted
+void huge_files(Recorder &rec, int scale, mt19937_64 &rng){
+    Store st;
+    const int files = 4;
+    size_t size = (size_t)(1 << 20) * scale;
+    for(int i = 0; i < files; ++i){
+        File* f = nullptr;
+        rec.time("create", [&]{ f = st.create("huge_" + to_string(i) + ".bin"); });
+        string text = random_text(rng, size);
+        rec.time("update", [&]{ f->update(text); });
+        rec.time("snapshot", [&]{ f->snapshot("initial"); });
+    }
+    for(int round = 0; round < 50; ++round){
+        for(int i = 0; i < files; ++i){
+            File* f = st.index.find("huge_" + to_string(i) + ".bin");
+            string text = random_text(rng, 256);
+            if(round % 2 == 0){
+                rec.time("insert", [&]{ f->insert(text); });
+            }
+            else{
+                string content = f->read();
+                content.replace(content.size() - text.size(), text.size(), text);
+                rec.time("update", [&]{ f->update(content); });
+            }
+            rec.time("snapshot", [&]{ f->snapshot(); });
+            rec.time("read", [&]{ f->read(); });
+        }
+    }
+    for(int i = 0; i < files; ++i){
+        File* f = st.index.find("huge_" + to_string(i) + ".bin");
+        for(int k = 0; k < 20; ++k){
+            int id = rng() % f->total_ver();
+            rec.time("rollback", [&]{ f->rollback(id); });
+            rec.time("read", [&]{ f->read(); });
+            rec.time("read_view", [&]{ f->read_view(); });
+            size_t offset = rng() % (f->read_view().size() + 1);
+            rec.time("read_range", [&]{ f->read_view(offset, 4096); });
+        }
+        // Byte diffs between nearby versions: mostly skipped by the prefix / suffix scans
+        OutputSink sink(-1);
+        for(int k = 0; k < 20; ++k){
+            int x = rng() % f->total_ver(), y = rng() % f->total_ver();
+            rec.time("diff", [&]{
+                write_diff(f->read_version(x), f->read_version(y), false, sink, f->shared_prefix(x, y));
+            });
+        }
+    }
+}
+
+// One file with a long linear chain of small appends, each snapshotted
+void deep_history(Recorder &rec, int scale, mt19937_64 &rng){
+    Store st;
+    int depth = 50000 * scale;
+    File* f = st.create("deep.txt");
+    for(int i = 0; i < depth; ++i){
+        string text = random_text(rng, 8);
+        rec.time("insert", [&]{ f->insert(text); });
+        rec.time("snapshot", [&]{ f->snapshot(); });
+    }
+    OutputSink sink(-1);
+    for(int k = 0; k < 20; ++k) rec.time("history", [&]{ f->history(sink); });
+    for(int k = 0; k < 1000; ++k) rec.time("history_n", [&]{ f->history(sink, 10); });
+    // Page through the whole history, 1000 snapshots at a time
+    for(int k = 0; k < 5; ++k){
+        uint32_t cursor = NO_VERSION;
+        do rec.time("history_page", [&]{ f->history(sink, 1000, cursor, &cursor); });
+        while(cursor != NO_VERSION);
+    }
+    string full = f->read();
+    for(int k = 0; k < 20; ++k){
+        string pattern = full.substr(rng() % (full.size() - 6), 6);
+        rec.time("search", [&]{ f->search(pattern); });
+    }
+    for(int k = 0; k < 10000; ++k){
+        int x = rng() % f->total_ver(), y = rng() % f->total_ver();
+        rec.time("ancestor", [&]{ f->common_ancestor(x, y); });
+    }
+    for(int k = 0; k < 1000; ++k){
+        int id = rng() % f->total_ver();
+        rec.time("rollback", [&]{ f->rollback(id); });
+        rec.time("read", [&]{ f->read(); });
+    }
+    f->rollback(depth);
+    for(int k = 0; k < 1000; ++k){
+        rec.time("rollback", [&]{ f->rollback(); });
+    }
+    // PRUNE leaves the chain above the last snapshots as tombstones that HISTORY must step over
+    f->rollback(depth);
+    rec.time("prune", [&]{ f->prune(2); });
+    for(int k = 0; k < 2000; ++k){
+        uint32_t next;
+        rec.time("history_pruned", [&]{ f->history(sink, 2, NO_VERSION, &next); });
+    }
+}
+
+// One file where every new version is a child of the root, reached via ROLLBACK
+void wide_branch(Recorder &rec, int scale, mt19937_64 &rng){
+    Store st;
+    int width = 50000 * scale;
+    File* f = st.create("wide.txt");
+    f->update(random_text(rng, 256));
+    f->snapshot("base");
+    for(int i = 0; i < width; ++i){
+        string text = random_text(rng, 32);
+        rec.time("rollback", [&]{ f->rollback(1); });
+        if(i % 2 == 0) rec.time("insert", [&]{ f->insert(text); });
+        else rec.time("update", [&]{ f->update(text); });
+        rec.time("snapshot", [&]{ f->snapshot(); });
+    }
+    for(int k = 0; k < 10000; ++k){
+        int id = rng() % f->total_ver();
+        rec.time("rollback", [&]{ f->rollback(id); });
+        rec.time("read", [&]{ f->read(); });
+    }
+    // Every branch but the active one is unnamed, so GC drops nearly the whole tree
+    rec.time("gc", [&]{ f->prune(); });
+}
+
+// Similar names (log_NNNNN.txt) looked up with a Zipf(1.1) distribution, as a log
+// directory would be; stresses the index with shared prefixes and hot keys
+void skewed_names(Recorder &rec, int scale, mt19937_64 &rng){
+    Store st;
+    int n = 100000 * scale;
+    vector<string> names;
+    names.reserve(n);
+    char buf[32];
+    for(int i = 0; i < n; ++i){
+        snprintf(buf, sizeof(buf), "log_%05d.txt", i);
+        names.push_back(buf);
+    }
+    for(int i = 0; i < n; ++i) rec.time("create", [&]{ st.create(names[i]); });
+    vector<double> cdf(n);
+    double sum = 0;
+    for(int i = 0; i < n; ++i){ sum += 1.0 / pow(i + 1, 1.1); cdf[i] = sum; }
+    uniform_real_distribution<double> u(0, sum);
+    int lookups = 10 * n;
+    for(int k = 0; k < lookups; ++k){
+        const string &name = names[lower_bound(cdf.begin(), cdf.end(), u(rng)) - cdf.begin()];
+        File* f = nullptr;
+        rec.time("lookup", [&]{ f = st.index.find(name); });
+        if(k % 100 == 0){
+            string text = random_text(rng, 24);
+            rec.time("insert", [&]{ f->insert(text); });
+        }
+    }
+    for(int k = 0; k < n / 10; ++k){
+        string miss = "log_" + to_string(n + k) + ".txt";
+        rec.time("miss", [&]{ st.index.find(miss); });
+    }
+}
+
+// One file written by one thread (under the file's lock, as the server does) while
+// readers call read() and history() on it without locking
+void shared_file(Recorder &rec, int scale, mt19937_64 &rng){
+    Store st;
+    const int readers = 3;
+    int writes = 20000 * scale;
+    File* f = st.create("shared.txt");
+    atomic<bool> done{false};
+    vector<Recorder> reader_recs(readers);
+    vector<thread> threads;
+    for(int r = 0; r < readers; ++r){
+        threads.emplace_back([&, r]{
+            OutputSink sink(-1);
+            for(int k = 0; !done.load(); ++k){
+                if(k % 8 == 0) reader_recs[r].time("history_n", [&]{ f->history(sink, 10); });
+                else reader_recs[r].time("read", [&]{ f->read(); });
+            }
+        });
+    }
+    for(int i = 0; i < writes; ++i){
+        string text = random_text(rng, 16);
+        lock_guard<File::mutex_type> lk(f->mutex());
+        if(i % 4 == 3) rec.time("update", [&]{ f->update(text); });
+        else rec.time("insert", [&]{ f->insert(text); });
+        rec.time("snapshot", [&]{ f->snapshot(); });
+        if(i % 64 == 63) rec.time("rollback", [&]{ f->rollback(); });
+    }
+    done = true;
+    for(thread &t : threads) t.join();
+    for(const Recorder &r : reader_recs) rec.merge(r);
+}
+
+// A large file branched from random old snapshots, each branch grown by many small appends
+void append_log(Recorder &rec, int scale, mt19937_64 &rng){
+    Store st;
+    File* f = st.create("log.txt");
+    string base = random_text(rng, 1 << 20);
+    f->update(base);
+    f->snapshot("base");
+    for(int branch = 0; branch < 20 * scale; ++branch){
+        int id = 1 + rng() % (f->total_ver() - 1);
+        rec.time("rollback", [&]{ f->rollback(id); });
+        for(int k = 0; k < 2000; ++k){
+            string text = random_text(rng, 64);
+            rec.time("insert", [&]{ f->insert(text); });
+        }
+        rec.time("read", [&]{ f->read(); });
+        rec.time("snapshot", [&]{ f->snapshot(); });
+    }
+}
+
+// Files with many rewritten snapshots of text, compressed as cold versions (and moved to the
+// segment store, if one is open) and read back at random
+void run_cold_history(Recorder &rec, int scale, mt19937_64 &rng){
+    Store st;
+    vector<string> lines;
+    for(int i = 0; i < 64; ++i) lines.push_back("line " + to_string(i) + ": " + random_text(rng, 24) + " status=ok value=" + to_string(i * 7) + "\n");
+    vector<File*> files;
+    for(int i = 0; i < 100 * scale; ++i){
+        File* f = st.create("config_" + to_string(i) + ".txt");
+        for(int v = 0; v < 40; ++v){
+            lines[rng() % 4] = "header " + to_string(v) + ": " + random_text(rng, 24) + "\n"; // Early change: stored in full
+            string text;
+            for(int r = 0; r < 4; ++r) for(const string &l : lines) text += l;
+            f->update(text);
+            f->snapshot();
+        }
+        f->rollback(1); // Everything after version 1 is now off the active path
+        files.push_back(f);
+    }
+    size_t before = blob_store.bytes(), compressed = 0, spilled = 0;
+    for(File* f : files){
+        size_t budget = SIZE_MAX;
+        rec.time("compress", [&]{ f->compress_cold(now(), 0, budget, compressed, spilled); });
+    }
+    printf("cold_history: compressed %zu version(s), %zu moved to disk, stored bytes %zu -> %zu\n", compressed, spilled, before,
+           blob_store.bytes());
+    for(int k = 0; k < 20000 * scale; ++k){
+        File* f = files[rng() % files.size()];
+        int id = 2 + rng() % (f->total_ver() - 2);
+        rec.time("read_cold", [&]{ f->read_version(id); });
+    }
+    cold_cache.clear();
+}
+
+void cold_history(Recorder &rec, int scale, mt19937_64 &rng){ run_cold_history(rec, scale, rng); }
+
+void spilled_history(Recorder &rec, int scale, mt19937_64 &rng){
+    string dir = (filesystem::temp_directory_path() / "vcs_bench_segments").string();
+    segment_store = make_unique<SegmentStore>(dir);
+    cold_cache.set_capacity(size_t(4) << 20); // Most reads go to disk
+    run_cold_history(rec, scale, rng);
+    cold_cache.set_capacity(size_t(64) << 20);
+    segment_store.reset();
+    filesystem::remove_all(dir);
+}
+
+// Deep history of small appends and a big file rewritten a few times, on BasicFile<Policy>; every
+// change takes the file's lock as the command layer does
+template <typename Policy>
+void run_policy(Recorder &rec, const string &label, int scale, uint64_t seed){
+    using F = BasicFile<Policy>;
+    mt19937_64 rng(seed); // The same edits for every policy
+    auto op = [&](const char* name){ return label + "/" + name; };
+    string snapshot = op("snapshot"), insert = op("insert"), update = op("update"), read = op("read_old"), history = op("history");
+    {
+        vector<string> lines; // Text repeats, as source and logs do, so that it compresses
+        for(int i = 0; i < 64; ++i) lines.push_back("line " + to_string(i) + ": " + random_text(rng, 24) + " status=ok\n");
+        F deep("deep.txt");
+        for(int i = 0; i < 2000 * scale; ++i){
+            const string &text = lines[rng() % lines.size()];
+            rec.time(insert.c_str(), [&]{ lock_guard<typename F::mutex_type> lk(deep.mutex()); deep.insert(text); });
+            rec.time(snapshot.c_str(), [&]{ lock_guard<typename F::mutex_type> lk(deep.mutex()); deep.snapshot(); });
+        }
+        F huge("huge.txt");
+        string content;
+        while(content.size() < (1 << 20)) content += lines[rng() % lines.size()];
+        for(int i = 0; i < 20 * scale; ++i){
+            content[rng() % content.size()] = 'X';
+            rec.time(update.c_str(), [&]{ lock_guard<typename F::mutex_type> lk(huge.mutex()); huge.update(content); });
+            rec.time(snapshot.c_str(), [&]{ lock_guard<typename F::mutex_type> lk(huge.mutex()); huge.snapshot(); });
+        }
+        for(int k = 0; k < 2000; ++k){
+            int id = rng() % deep.total_ver();
+            rec.time(read.c_str(), [&]{ lock_guard<typename F::mutex_type> lk(deep.mutex()); deep.read_version(id); });
+        }
+        for(int k = 0; k < 200; ++k){
+            int id = rng() % huge.total_ver();
+            rec.time(read.c_str(), [&]{ lock_guard<typename F::mutex_type> lk(huge.mutex()); huge.read_version(id); });
+        }
+        OutputSink sink(-1);
+        for(int k = 0; k < 20; ++k) rec.time(history.c_str(), [&]{ deep.history(sink); });
+        FileStats st;
+        deep.add_stats(st);
+        huge.add_stats(st);
+        printf("policies: %-13s versions store %llu bytes\n", label.c_str(), (unsigned long long)st.own_bytes);
+    }
+    cold_cache.clear();
+}
+
+void policies(Recorder &rec, int scale, mt19937_64 &rng){
+    uint64_t seed = rng();
+    run_policy<FilePolicy<DeltaStorage, ArenaAllocator<4>, mutex>>(rec, "delta", scale, seed);
+    run_policy<FilePolicy<FullCopyStorage, ArenaAllocator<4>, mutex>>(rec, "full", scale, seed);
+    run_policy<FilePolicy<CompressedStorage, ArenaAllocator<4>, mutex>>(rec, "compressed", scale, seed);
+    run_policy<FilePolicy<DeltaStorage, ArenaAllocator<12>, mutex>>(rec, "delta_arena12", scale, seed);
+    run_policy<FilePolicy<DeltaStorage, ArenaAllocator<4>, NoLock>>(rec, "delta_nolock", scale, seed);
+}
+
+struct Workload
+{
+    const char* name;
+    void (*run)(Recorder &, int, mt19937_64 &);
+};
+
+int main(int argc, char* argv[]){
+    const Workload workloads[] = {
+        {"small_files", small_files},
+        {"huge_files", huge_files},
+        {"deep_history", deep_history},
+        {"wide_branch", wide_branch},
+        {"skewed_names", skewed_names},
+        {"shared_file", shared_file},
+        {"append_log", append_log},
+        {"cold_history", cold_history},
+        {"spilled_history", spilled_history},
+        {"policies", policies},
+    };
+    int scale = 1;
+    string only = "all";
+    unsigned long long seed = 42;
+    for(int i = 1; i < argc; ++i){
+        string arg = argv[i];
+        if(arg.rfind("--scale=", 0) == 0) scale = atoi(arg.c_str() + 8);
+        else if(arg.rfind("--workload=", 0) == 0) only = arg.substr(11);
+        else if(arg.rfind("--seed=", 0) == 0) seed = strtoull(arg.c_str() + 7, nullptr, 10);
+        else{
+            fprintf(stderr, "Error: Unknown option: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    if(scale < 1){
+        fprintf(stderr, "Error: --scale must be a positive integer\n");
+        return 1;
+    }
+    bool found = false;
+    for(const Workload &w : workloads){
+        if(only != "all" && only != w.name) continue;
+        found = true;
+        Recorder rec;
+        mt19937_64 rng(seed);
+        bench_clock::time_point t0 = bench_clock::now();
+        w.run(rec, scale, rng);
+        double secs = chrono::duration<double>(bench_clock::now() - t0).count();
+        rec.report(w.name);
+        printf("    wall %.3f s, peak RSS %ld KB\n\n", secs, peak_rss_kb());
+    }
+    if(!found){
+        fprintf(stderr, "Error: Unknown workload: %s\n", only.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,1122 @@
+//
+// Version tree of a single file: TreeNode (one version) and File (the tree,
+// its active version and all file operations), plus the shared blob store and
+// clock they use. Shared by the CLI and the benchmark.
+//
+
+#ifndef VERSION_FILE_H
+#define VERSION_FILE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "append_buffer.h"
+#include "blob_store.h"
+#include "clock.h"
+#include "cold_cache.h"
+#include "epoch.h"
+#include "node_arena.h"
+#include "output_sink.h"
+#include "lz_codec.h"
+#include "rank_index.h"
+#include "ref_table.h"
+#include "repo_format.h"
+#include "search_index.h"
+#include "segment_store.h"
+#include "storage_policy.h"
+
+// Time of the command being run by this thread (see clock.h). Sampled once per command, so
+// every timestamp a command records agrees; set from the log when a command is replayed.
+inline thread_local Timestamp command_clock = 0;
+
+// Current timestamp for version metadata
+inline Timestamp now(){
+    return command_clock != 0 ? command_clock : clock_now();
+}
+
+// Formats timestamps as human readable strings (ctime() format without trailing newline, to the
+// second). Uses the reentrant localtime variants and keeps its state in the object, so it is safe
+// to use from several threads with one formatter each. Remembers the last minute formatted:
+// timestamps in the same minute (as in a long HISTORY) only have their seconds digits rewritten.
+class TimeFormatter
+{
+    private:
+        int64_t minute_start = 1; // First second of the cached minute (1: none cached yet)
+        char buf[64];
+        size_t len = 0;
+
+    public:
+        std::string_view operator()(Timestamp ts){
+            int64_t secs = timestamp_seconds(ts);
+            if(minute_start > secs || secs - minute_start >= 60){
+                time_t t = (time_t)secs;
+                struct tm parts;
+#ifdef _WIN32
+                localtime_s(&parts, &t);
+#else
+                localtime_r(&t, &parts);
+#endif
+                len = std::strftime(buf, sizeof(buf), "%a %b %e %H:%M:%S %Y", &parts);
+                minute_start = len >= 19 ? secs - parts.tm_sec : 1;
+                if(len < 19) return std::string_view(buf, len);
+            }
+            int sec = int(secs - minute_start); // "Www Mmm dd hh:mm:ss", seconds at 17
+            buf[17] = char('0' + sec / 10);
+            buf[18] = char('0' + sec % 10);
+            return std::string_view(buf, len);
+        }
+};
+
+inline std::string format_time(Timestamp ts){
+    TimeFormatter format;
+    return std::string(format(ts));
+}
+
+// Content storage: a version either stores its full content (a keyframe) or a
+// delta against its parent: "the first base_len bytes of the parent's content,
+// followed by data". Parents of delta nodes are always snapshots, so the bytes
+// a delta refers to never change. At most KEYFRAME_INTERVAL deltas (set by the
+// storage policy, see storage_policy.h) are chained below a snapshot before a
+// keyframe is forced, which bounds the cost of rebuilding a version.
+// A branch appended to its parent is therefore a delta with base_len equal to the
+// parent's length: creating it copies nothing of the parent. While the active
+// version is appended to in place, its data lives in the File's AppendBuffer rather than
+// the blob store (see append_buffer.h) and is interned when the version is
+// snapshotted or left.
+// Snapshots nobody has used for a while (see File::compress_cold()) may have those
+// bytes stored LZ-compressed instead; they are decompressed, through cold_cache,
+// whenever a delta chain needs them. With --store their (possibly compressed) bytes
+// may also be moved out of memory to segment_store and are then read back from disk
+// the same way.
+// Shared content-addressed store for the bytes of every version of every file
+inline BlobStore blob_store;
+
+// Recently decompressed cold versions (after blob_store: entries hold blob references)
+inline ColdCache cold_cache;
+
+// On-disk segments holding the bytes of cold versions moved out of memory (set by --store; see
+// segment_store.h)
+inline std::unique_ptr<SegmentStore> segment_store;
+
+// Reclaims the FileHeads that lock-free readers may still be using (defined after
+// blob_store so that it is destroyed first: retired heads still hold blob references)
+inline EpochDomain epochs;
+
+// No version (parent of the root, end of a child list)
+const uint32_t NO_VERSION = UINT32_MAX;
+
+// TreeNode represents a version of a file in the version tree
+// Each node stores content (as a delta), message, timestamps, parent, and children.
+// Nodes live in their File's arena; links are 32-bit version ids into that arena.
+class TreeNode
+{
+    public:
+        uint32_t version_id; // Unique version identifier (index in the file's arena)
+        uint32_t parent; // Parent version id (NO_VERSION for the root)
+        uint32_t first_child; // Most recently created child version id
+        uint32_t next_sibling; // Next older child of the same parent
+        uint32_t depth; // Number of ancestors (0 for the root)
+        uint32_t jump; // Jump pointer: an ancestor chosen so any ancestor is reachable in O(log depth) hops
+        uint32_t kept_parent; // Nearest ancestor that is not pruned (NO_VERSION if none), so HISTORY skips tombstones
+        BlobRef data; // Bytes stored at this version (full content for a keyframe), in blob_store
+        size_t base_len; // Bytes of the parent's content reused as prefix (0 = keyframe)
+        size_t length; // Total content length at this version
+        int delta_depth; // Deltas between this version and its keyframe (0 = keyframe)
+        bool pruned; // Dropped by GC / PRUNE: only the tree links are left
+        bool compressed; // data holds the LZ-compressed form of this version's bytes
+        Timestamp created_ts; // Creation timestamp
+        Timestamp snapshot_ts; // Snapshot timestamp (0 if not a snapshot)
+        std::string message; // Snapshot message (if any)
+        uint64_t spilled; // Key of data in segment_store once it has been moved there (data is then empty), else 0
+        Timestamp last_used; // Last time this version was created, snapshotted, made active or left
+        TreeNode(uint32_t id, uint32_t parent_id) : version_id(id), parent(parent_id), first_child(NO_VERSION), next_sibling(NO_VERSION),
+            depth(0), jump(0), kept_parent(parent_id), base_len(0), length(0), delta_depth(0), pruned(false), compressed(false), created_ts(now()), snapshot_ts(0),
+            message(""), spilled(0), last_used(created_ts) {}
+};
+
+// Ordered indexes over all files, kept up to date by File itself
+// recent: by last modification time (RECENT_FILES), biggest: by version count (BIGGEST_TREES)
+// lock must be held to read either index; File takes it for its updates.
+template <typename FileT>
+struct BasicFileRankings
+{
+    std::mutex lock;
+    RankIndex<Timestamp, FileT> recent;
+    RankIndex<int, FileT> biggest;
+};
+
+using FileRankings = BasicFileRankings<File>;
+
+// Totals over the versions of one or more files (see File::add_stats())
+struct FileStats
+{
+    uint64_t versions = 0;
+    uint64_t snapshots = 0;
+    uint64_t pruned = 0;
+    uint64_t compressed = 0;
+    uint64_t spilled = 0; // Versions whose bytes are in segment_store
+    uint64_t refs = 0;
+    uint64_t logical_bytes = 0; // Content lengths of all live versions added up
+    uint64_t own_bytes = 0; // Bytes each version stores itself (deltas, compressed), before deduplication
+};
+
+// Read-only view of one version, whether it lives in the arena or in a loaded repository image
+struct VersionView
+{
+    uint32_t parent;
+    uint32_t depth;
+    uint32_t jump;
+    uint32_t kept_parent;
+    size_t base_len;
+    size_t length;
+    std::string_view data;
+    std::string_view message;
+    Timestamp created_ts;
+    Timestamp snapshot_ts;
+    bool pruned;
+    bool compressed; // data is LZ-compressed (length - base_len bytes when decompressed)
+    uint64_t spilled; // Key of data in segment_store (data is then empty), else 0
+    const BlobRef* blob; // The blob behind data, if it is in blob_store (null for image data)
+    std::shared_ptr<const AppendBuffer> appending; // Holds data instead while the version is appended to
+};
+
+// Everything a reader needs about a file's current state, published atomically.
+// Snapshotted versions never change and only the active version can still be modified in
+// place, so a reader that takes the active version from a FileHead and all its ancestors
+// from the version tree sees a consistent state without locking. A FileHead is immutable;
+// writers publish a new one after every change and retire the old one to epochs.
+struct FileHead
+{
+    uint32_t active_id;
+    int versions; // Version count at publication
+    VersionView active; // Copy of the active version; data and message point into this head
+    BlobRef data; // Keeps active.data alive (or active.appending does, while it is appended to)
+    std::string message; // Backs active.message
+    std::shared_ptr<const RepoImage> image; // Set while the versions are served from a repository image
+    const RepoFileRecord* record;
+};
+
+// Content of a version, or a range of it, as the pieces of stored bytes it is made of, in
+// order and without copying them. Holds references to everything the pieces point into
+// (blobs, the append buffer, decompressed cold bytes, the repository image), so it stays
+// valid however the file changes later, with no lock or epoch held.
+class ContentView
+{
+    private:
+        struct Owner
+        {
+            std::vector<BlobRef> blobs;
+            std::vector<std::shared_ptr<const std::string>> expanded;
+            std::vector<std::shared_ptr<const AppendBuffer>> buffers;
+            std::shared_ptr<const RepoImage> image;
+        };
+        std::vector<std::string_view> parts;
+        std::shared_ptr<Owner> keep = std::make_shared<Owner>();
+        size_t total = 0;
+        template <typename Policy> friend class BasicFile;
+
+    public:
+        const std::vector<std::string_view> &pieces() const {return parts;}
+        size_t size() const {return total;}
+
+        // Reference keeping every piece valid
+        std::shared_ptr<const void> owner() const {return keep;}
+
+        // The content as one string (a copy)
+        std::string str() const {
+            std::string s;
+            s.reserve(total);
+            for(std::string_view p : parts) s.append(p);
+            return s;
+        }
+};
+
+// Write content without copying its large pieces (see OutputSink::write_shared())
+inline OutputSink &operator<<(OutputSink &out, const ContentView &v){
+    std::shared_ptr<const void> owner = v.owner();
+    for(std::string_view p : v.pieces()) out.write_shared(p, owner);
+    return out;
+}
+
+// File class manages the version tree for a single file, laid out as Policy says (see
+// storage_policy.h; File is the build's default)
+// Supports operations: read, insert, update, snapshot, rollback, history
+// Changes must be serialized by the caller (see mutex()); read(), history() and
+// common_ancestor() need no lock and may run concurrently with a change.
+template <typename Policy>
+class BasicFile
+{
+    public:
+        using mutex_type = typename Policy::mutex_type;
+        using Rankings = BasicFileRankings<BasicFile>;
+        static constexpr int KEYFRAME_INTERVAL = Policy::storage::keyframe_interval;
+
+    private:
+        std::string file_name; // Name the file was created under
+        uint64_t seq; // Creation order, used to break ranking ties
+        Rankings* rankings; // Indexes to notify on change (may be null)
+        uint32_t active_id; // Current version id
+        // Holds the active version's bytes instead of its data while INSERTs grow it in place
+        // (only the active version is ever appended to; sealed before it stops being active)
+        std::shared_ptr<AppendBuffer> appending;
+        typename Policy::allocator::template arena<TreeNode> version_map; // All versions, indexed by version id (0 = root)
+        Timestamp last_modification; // Last modification timestamp
+        // Set while a file LOADed from disk has not been modified yet: its versions are
+        // then read straight from the repository image instead of version_map
+        std::shared_ptr<const RepoImage> image;
+        const RepoFileRecord* record;
+        // Held while a change runs; taken by the command layer
+        mutable mutex_type guard;
+        // Latest published state for lock-free readers
+        std::atomic<FileHead*> head{nullptr};
+        // Branches and tags, and the checked-out branch (RefTable::npos if none). Guarded by the
+        // file's lock like the version tree; lock-free readers never look at them.
+        RefTable refs;
+        uint32_t current_ref = RefTable::npos;
+        // Trigram index of the bytes each snapshot stores itself, for search(). Created by the
+        // first search and kept up to date by snapshot() from then on; guarded by the file's lock.
+        std::unique_ptr<TrigramIndex> search_index;
+        // Set between begin_batch() and end_batch(): changes are neither published nor ranked until
+        // the end. batch_ts / batch_versions are the ranking keys from before the batch.
+        bool batching = false;
+        Timestamp batch_ts = 0;
+        int batch_versions = 0;
+
+        // Record a modification at time t and re-key this file in the rankings
+        void touch(Timestamp t, int old_versions){
+            Timestamp old_ts = last_modification;
+            last_modification = t;
+            if(rankings == nullptr || batching) return;
+            std::lock_guard<std::mutex> lk(rankings->lock);
+            rankings->recent.rekey(this, seq, old_ts, last_modification);
+            rankings->biggest.rekey(this, seq, old_versions, total_ver());
+        }
+
+        TreeNode* active_version(){ return &version_map[active_id]; }
+
+        // Parent of a version, or nullptr for the root
+        TreeNode* parent_of(const TreeNode* node){
+            return node->parent == NO_VERSION ? nullptr : &version_map[node->parent];
+        }
+
+        static VersionView image_view(const RepoImage &img, const RepoFileRecord &rec, uint32_t id){
+            const RepoNodeRecord &r = img.node(rec, id);
+            return VersionView{r.parent, r.depth, r.jump, r.kept_parent, (size_t)r.base_len, (size_t)r.length, img.blob(r.blob), img.message(r),
+                               r.created_ts, r.snapshot_ts, (r.flags & REPO_NODE_PRUNED) != 0,
+                               (r.flags & REPO_NODE_COMPRESSED) != 0, 0, nullptr, nullptr};
+        }
+
+        static VersionView node_view(const TreeNode &n){
+            return VersionView{n.parent, n.depth, n.jump, n.kept_parent, n.base_len, n.length, n.data.view(), n.message, n.created_ts,
+                               n.snapshot_ts, n.pruned, n.compressed, n.spilled, &n.data, nullptr};
+        }
+
+        // A version as the writer sees it (current state)
+        VersionView view(uint32_t id) const {
+            if(image != nullptr) return image_view(*image, *record, id);
+            VersionView v = node_view(version_map[id]);
+            if(id == active_id && appending != nullptr){
+                v.data = appending->view();
+                v.appending = appending;
+            }
+            return v;
+        }
+
+        // A version as of a published head
+        VersionView view(uint32_t id, const FileHead &h) const {
+            if(id == h.active_id) return h.active;
+            return h.image != nullptr ? image_view(*h.image, *h.record, id) : node_view(version_map[id]);
+        }
+
+        // Tree position of a version. Fixed when the version is created (unlike its content,
+        // which may change while it is an unsnapshotted leaf), so readers may look up any
+        // version published to them.
+        struct Links { uint32_t parent, depth, jump; };
+        Links links(uint32_t id, const FileHead &h) const {
+            if(h.image != nullptr){
+                const RepoNodeRecord &r = h.image->node(*h.record, id);
+                return Links{r.parent, r.depth, r.jump};
+            }
+            const TreeNode &n = version_map[id];
+            return Links{n.parent, n.depth, n.jump};
+        }
+
+        // Publish the current state to readers
+        void publish(){
+            if(batching) return; // end_batch() publishes
+            FileHead* h = new FileHead;
+            h->active_id = active_id;
+            h->versions = total_ver();
+            h->image = image;
+            h->record = record;
+            if(image != nullptr){
+                h->active = view(active_id); // Points into the image, which h keeps mapped
+            }
+            else{
+                const TreeNode &n = version_map[active_id];
+                h->data = n.data;
+                h->message = n.message;
+                h->active = view(active_id); // Its data view stays valid: appends only write past its end
+                h->active.message = h->message;
+                h->active.blob = &h->data;
+            }
+            FileHead* old = head.exchange(h, std::memory_order_seq_cst);
+            if(old != nullptr) epochs.retire(old);
+        }
+
+        // Bytes of a compressed or spilled version, read back and decompressed (through cold_cache
+        // unless they are in a repository image)
+        static std::shared_ptr<const std::string> expand(const VersionView &n){
+            if(n.length < n.base_len) throw std::runtime_error("Corrupt compressed data");
+            if(n.spilled != 0){
+                return cold_cache.get_segment(n.spilled, [&]{
+                    std::string bytes = segment_store->read(n.spilled);
+                    return n.compressed ? lz_decompress(bytes, n.length - n.base_len) : bytes;
+                });
+            }
+            if(n.blob != nullptr) return cold_cache.get(*n.blob, n.length - n.base_len);
+            return std::make_shared<const std::string>(lz_decompress(n.data, n.length - n.base_len));
+        }
+
+        // Walk the delta chain of version id (as of head h, if given) and call piece(bytes, version,
+        // expanded) for each stored piece of bytes [from, to) of its content, in order; expanded
+        // holds the bytes of a compressed or spilled version. Returns the content length.
+        template <typename Piece>
+        size_t collect(uint32_t id, const FileHead* h, size_t from, size_t to, Piece piece) const {
+            // (version, number of leading bytes of its content that are needed)
+            std::vector<std::pair<VersionView, size_t>> chain;
+            VersionView v = h ? view(id, *h) : view(id);
+            size_t length = v.length, want = std::min(length, to);
+            while(true){
+                chain.push_back({v, want});
+                size_t from_base = std::min(want, v.base_len);
+                if(from_base <= from) break; // Nothing further up is in the range
+                v = h ? view(v.parent, *h) : view(v.parent);
+                want = from_base;
+            }
+            for(auto it = chain.rbegin(); it != chain.rend(); ++it){
+                const VersionView &n = it->first;
+                size_t lo = std::max(n.base_len, from), hi = it->second;
+                if(hi <= lo) continue;
+                std::shared_ptr<const std::string> expanded;
+                std::string_view bytes = n.data;
+                if(n.compressed || n.spilled != 0){
+                    expanded = expand(n);
+                    bytes = *expanded;
+                }
+                if(lo - n.base_len < bytes.size()) piece(bytes.substr(lo - n.base_len, hi - lo), n, expanded);
+            }
+            return length;
+        }
+
+        // Rebuild the content of a version (as of head h, if given)
+        std::string materialize(uint32_t id, const FileHead* h = nullptr) const {
+            std::string out;
+            out.reserve((h ? view(id, *h) : view(id)).length);
+            collect(id, h, 0, SIZE_MAX, [&](std::string_view bytes, const VersionView &, const std::shared_ptr<const std::string> &) {
+                out.append(bytes);
+            });
+            return out;
+        }
+
+        // Bytes [offset, offset + len) of a version (clipped to its end) as a ContentView (as of head h, if given)
+        ContentView content(uint32_t id, const FileHead* h, size_t offset, size_t len) const {
+            ContentView cv;
+            ContentView::Owner &keep = *cv.keep;
+            size_t to = len > SIZE_MAX - offset ? SIZE_MAX : offset + len;
+            size_t length = collect(id, h, offset, to, [&](std::string_view bytes, const VersionView &n, const std::shared_ptr<const std::string> &expanded) {
+                if(expanded != nullptr) keep.expanded.push_back(expanded);
+                else if(n.appending != nullptr) keep.buffers.push_back(n.appending);
+                else if(n.blob != nullptr) keep.blobs.push_back(*n.blob);
+                else keep.image = h ? h->image : image;
+                cv.parts.push_back(bytes);
+                cv.total += bytes.size();
+            });
+            if(offset > length) {
+                throw std::out_of_range("Offset is past the end of the content");
+            }
+            return cv;
+        }
+
+        // Length of the common prefix of two contents
+        static size_t common_prefix(const ContentView &a, const ContentView &b){
+            size_t ia = 0, ib = 0, oa = 0, ob = 0, same = 0;
+            while(ia < a.pieces().size() && ib < b.pieces().size()){
+                std::string_view x = a.pieces()[ia].substr(oa), y = b.pieces()[ib].substr(ob);
+                size_t n = std::min(x.size(), y.size());
+                if(std::memcmp(x.data(), y.data(), n) != 0){
+                    return same + (std::mismatch(x.begin(), x.begin() + n, y.begin()).first - x.begin());
+                }
+                same += n;
+                oa += n;
+                ob += n;
+                if(oa == a.pieces()[ia].size()){ ++ia; oa = 0; }
+                if(ob == b.pieces()[ib].size()){ ++ib; ob = 0; }
+            }
+            return same;
+        }
+
+        // Add version id to search_index: the bytes past the prefix it shares with its parent.
+        // For a delta that is what it stores itself; a keyframe is compared with its parent,
+        // since one cut from a chain of appends repeats nearly all of it.
+        void index_version(uint32_t id){
+            VersionView v = view(id);
+            size_t prefix = v.base_len;
+            if(prefix == 0 && v.parent != NO_VERSION && !view(v.parent).pruned){
+                prefix = common_prefix(content(v.parent, nullptr, 0, SIZE_MAX), content(id, nullptr, 0, SIZE_MAX));
+            }
+            search_index->add(id, prefix, content(id, nullptr, prefix, SIZE_MAX).pieces());
+        }
+
+        // Position of the first occurrence of pattern in the bytes of cv
+        static size_t find_in(const ContentView &cv, std::string_view pattern){
+            if(cv.pieces().size() == 1) return find_bytes(cv.pieces()[0], pattern);
+            return find_bytes(cv.str(), pattern);
+        }
+
+        // Store content in node, as a delta against its parent when at least half of it is shared
+        void store(TreeNode* node, std::string_view content){
+            size_t shared = 0;
+            TreeNode* p = parent_of(node);
+            if(p != nullptr && !p->pruned && p->delta_depth + 1 < KEYFRAME_INTERVAL && !content.empty()){
+                std::string base = materialize(p->version_id);
+                shared = std::mismatch(base.begin(), base.begin() + std::min(base.size(), content.size()), content.begin()).first - base.begin();
+                if(shared * 2 < content.size()) shared = 0;
+            }
+            node->base_len = shared;
+            node->data = blob_store.intern(content.substr(shared));
+            if(node->version_id == active_id) appending.reset();
+            node->compressed = false;
+            node->length = content.size();
+            node->delta_depth = shared ? p->delta_depth + 1 : 0;
+        }
+
+        // Append content to the bytes stored at the unsnapshotted active version, growing appending
+        void append_in_place(std::string_view content){
+            TreeNode* node = active_version();
+            if(appending == nullptr || !appending->append(content)){
+                std::string_view stored = appending ? appending->view() : node->data.view();
+                appending = AppendBuffer::grown(stored, content);
+                node->data = BlobRef();
+            }
+            node->length += content.size();
+        }
+
+        // Store a version's bytes LZ-compressed if that saves at least an eighth of them; returns
+        // whether it did
+        static bool compress(TreeNode &n){
+            if(n.compressed || n.data.size() < 64) return false;
+            std::string packed = lz_compress(n.data.view());
+            if(packed.size() > n.data.size() - n.data.size() / 8) return false;
+            n.data = blob_store.intern(packed);
+            n.compressed = true;
+            return true;
+        }
+
+        // Drop the copy a version's bytes have in segment_store, before they are replaced or dropped
+        static void unspill(TreeNode &n){
+            if(n.spilled == 0) return;
+            segment_store->release(n.spilled);
+            n.spilled = 0;
+        }
+
+        // Move the appended-to active version's bytes into the blob store; done before it is
+        // snapshotted or stops being the active version
+        void seal(){
+            if(appending == nullptr) return;
+            active_version()->data = blob_store.intern(appending->view());
+            appending.reset();
+        }
+
+        // Make id the active version; a checked-out branch moves along with it
+        void move_to(uint32_t id){
+            if(id != active_id) seal();
+            if(image == nullptr){
+                Timestamp t = now();
+                version_map[active_id].last_used = t;
+                version_map[id].last_used = t;
+            }
+            active_id = id;
+            if(current_ref != RefTable::npos) refs.retarget(current_ref, id);
+        }
+
+        // Create a new child version of the (snapshotted) active version and make it active
+        TreeNode* branch(){
+            TreeNode* p = active_version();
+            TreeNode* nd = version_map.emplace_back(version_map.size(), p->version_id);
+            nd->next_sibling = p->first_child;
+            p->first_child = nd->version_id;
+            // Skew-binary jump pointers: jump either to the parent or two jumps up, so that
+            // jump lengths along any path are 1, 1, 3, 1, 1, 3, 7, ... and both ancestor
+            // lookups and common-ancestor queries take O(log depth) hops
+            nd->depth = p->depth + 1;
+            const TreeNode &j = version_map[p->jump];
+            if(p->depth - j.depth == j.depth - version_map[j.jump].depth) nd->jump = j.jump;
+            else nd->jump = p->version_id;
+            move_to(nd->version_id);
+            return nd;
+        }
+
+        // Ancestor of version id at the given depth (which must not exceed id's depth), as of head h
+        uint32_t ancestor_at(uint32_t id, uint32_t depth, const FileHead &h) const {
+            Links v = links(id, h);
+            while(v.depth > depth){
+                id = links(v.jump, h).depth >= depth ? v.jump : v.parent;
+                v = links(id, h);
+            }
+            return id;
+        }
+
+        // Throw unless id names a version that GC / PRUNE has not dropped (id must be in range)
+        void check_live(uint32_t id) const {
+            if(view(id).pruned) {
+                throw std::runtime_error("Version " + std::to_string(id) + " has been pruned");
+            }
+        }
+
+        // Deserialize a LOADed file's versions into version_map before its first modification
+        void ensure_loaded(){
+            if(image == nullptr) return;
+            for(uint32_t id = 0; id < record->node_count; ++id){
+                const RepoNodeRecord &r = image->node(*record, id);
+                TreeNode* nd = version_map.emplace_back(id, r.parent);
+                if(r.parent != REPO_NO_NODE){
+                    TreeNode &p = version_map[r.parent];
+                    nd->next_sibling = p.first_child;
+                    p.first_child = id;
+                }
+                nd->data = blob_store.intern(image->blob(r.blob));
+                nd->base_len = r.base_len;
+                nd->length = r.length;
+                nd->delta_depth = r.delta_depth;
+                nd->depth = r.depth;
+                nd->jump = r.jump;
+                nd->kept_parent = r.kept_parent;
+                nd->created_ts = r.created_ts;
+                nd->snapshot_ts = r.snapshot_ts;
+                nd->message = image->message(r);
+                nd->pruned = (r.flags & REPO_NODE_PRUNED) != 0;
+                nd->compressed = (r.flags & REPO_NODE_COMPRESSED) != 0;
+                nd->last_used = std::max(nd->created_ts, nd->snapshot_ts);
+            }
+            image.reset();
+            record = nullptr;
+        }
+
+    public:
+        BasicFile(const std::string &name = "", uint64_t seq_no = 0, Rankings* ranks = nullptr)
+            : file_name(name), seq(seq_no), rankings(ranks), last_modification(now()), record(nullptr) {
+            active_id = version_map.emplace_back(0, NO_VERSION)->version_id;
+            snapshot("");
+            if(rankings != nullptr){
+                std::lock_guard<std::mutex> lk(rankings->lock);
+                rankings->recent.add(this, seq, last_modification);
+                rankings->biggest.add(this, seq, total_ver());
+            }
+        }
+
+        // A file stored in a repository image; versions stay in the image until first modified
+        BasicFile(std::shared_ptr<const RepoImage> img, const RepoFileRecord &rec, Rankings* ranks = nullptr)
+            : file_name(img->name(rec)), seq(rec.seq), rankings(ranks), active_id(rec.active_version),
+              last_modification(rec.last_modification), image(img), record(&rec) {
+            for(uint32_t i = 0; i < rec.ref_count; ++i){
+                const RepoRefRecord &r = img->ref(rec, i);
+                if(refs.find(img->name(r)) != RefTable::npos || image_view(*img, rec, r.target).pruned) {
+                    throw std::runtime_error("Invalid repository file");
+                }
+                refs.add(img->name(r), static_cast<RefKind>(r.kind), r.target);
+            }
+            current_ref = rec.current_ref == REPO_NO_REF ? RefTable::npos : rec.current_ref;
+            if((current_ref != RefTable::npos && refs[current_ref].kind != RefKind::BRANCH) || view(active_id).pruned) {
+                throw std::runtime_error("Invalid repository file");
+            }
+            publish();
+            if(rankings != nullptr){
+                std::lock_guard<std::mutex> lk(rankings->lock);
+                rankings->recent.add(this, seq, last_modification);
+                rankings->biggest.add(this, seq, total_ver());
+            }
+        }
+
+        BasicFile(const BasicFile &) = delete;
+        BasicFile &operator=(const BasicFile &) = delete;
+        ~BasicFile(){ delete head.load(); } // No reader can outlive the file
+
+        // Get file name
+        const std::string &name() const {return file_name;}
+
+        // Lock serializing changes to this file (a no-op with the NoLock policy)
+        mutex_type &mutex() const {return guard;}
+
+        // Get last modification timestamp
+        Timestamp last_ts(){return last_modification;}
+
+        // Get total number of versions (writer's view)
+        int total_ver() const {return image != nullptr ? record->node_count : version_map.size();}
+
+        // Whether version id has been published (versions are never removed). Lock-free.
+        bool has_version(uint32_t id) const {
+            EpochGuard pinned(epochs);
+            return id < (uint32_t)head.load(std::memory_order_seq_cst)->versions;
+        }
+
+        // Read content of current version (lock-free)
+        std::string read() const {
+            EpochGuard pinned(epochs);
+            const FileHead* h = head.load(std::memory_order_seq_cst);
+            return materialize(h->active_id, h);
+        }
+
+        // Bytes [offset, offset + len) of the current version, clipped to its end, without copying
+        // them (lock-free). The view stays valid however the file changes afterwards.
+        ContentView read_view(size_t offset = 0, size_t len = SIZE_MAX) const {
+            EpochGuard pinned(epochs);
+            const FileHead* h = head.load(std::memory_order_seq_cst);
+            return content(h->active_id, h, offset, len);
+        }
+
+        // Whether the active version is a snapshot (so the next change creates a new version)
+        bool active_is_snapshot() const {return view(active_id).snapshot_ts != 0;}
+
+        // Group the changes that follow until end_batch(), which publishes them to readers and
+        // re-keys the rankings once for all of them. Used by transactions, which hold the whole
+        // repository, so no reader can look at the file in between.
+        void begin_batch(){
+            batching = true;
+            batch_ts = last_modification;
+            batch_versions = total_ver();
+        }
+        void end_batch(){
+            batching = false;
+            publish();
+            if(rankings == nullptr) return;
+            std::lock_guard<std::mutex> lk(rankings->lock);
+            rankings->recent.rekey(this, seq, batch_ts, last_modification);
+            rankings->biggest.rekey(this, seq, batch_versions, total_ver());
+        }
+
+        // Insert content at current version (appends if not a snapshot, else creates new version)
+        void insert(std::string_view content){
+            ensure_loaded();
+            int old_versions = total_ver();
+            if (active_version()->snapshot_ts == 0){
+                append_in_place(content);
+            }
+            else{
+                // Appending never changes the parent's bytes: store only the new suffix, whatever
+                // the parent's size. A delta past KEYFRAME_INTERVAL is rewritten at snapshot time.
+                TreeNode* p = active_version();
+                TreeNode* nd = branch();
+                nd->base_len = p->length;
+                nd->data = blob_store.intern(content);
+                nd->length = p->length + content.size();
+                nd->delta_depth = p->length ? p->delta_depth + 1 : 0;
+            }
+            touch(now(), old_versions);
+            publish();
+        }
+
+        // Update content at current version (replaces if not a snapshot, else creates new version)
+        void update(std::string_view content){
+            ensure_loaded();
+            int old_versions = total_ver();
+            if (active_version()->snapshot_ts == 0){
+                store(active_version(), content);
+            }
+            else{
+                store(branch(), content);
+            }
+            touch(now(), old_versions);
+            publish();
+        }
+
+        // Create a snapshot at current version with optional message
+        void snapshot(std::string_view mess = ""){
+            if(view(active_id).snapshot_ts != 0) {
+                throw std::runtime_error("Current version is already a snapshot");
+            }
+            ensure_loaded();
+            TreeNode* nd = active_version();
+            // Only a snapshot can become a parent, so this is where an over-long delta chain is cut
+            if(nd->delta_depth >= KEYFRAME_INTERVAL) store(nd, materialize(active_id));
+            else seal();
+            if(Policy::storage::compress_snapshots) compress(*nd);
+            nd -> snapshot_ts = now();
+            nd -> last_used = nd -> snapshot_ts;
+            nd -> message = mess;
+            if(search_index) index_version(active_id);
+            touch(nd -> snapshot_ts, total_ver());
+            publish();
+        }
+
+        // Rollback to a previous version by id, or to parent if no id given
+        void rollback(int id = -1){
+            if(image == nullptr) seal();
+            if(id != -1) {
+                if(id < 0 || id >= total_ver()) {
+                    throw std::out_of_range("Invalid version id for rollback");
+                }
+                check_live(id);
+                move_to(id);
+            } else {
+                uint32_t parent = view(active_id).parent;
+                if(parent == NO_VERSION) {
+                    throw std::runtime_error("No parent version to rollback to");
+                }
+                check_live(parent);
+                move_to(parent);
+            }
+            publish();
+        }
+
+        // Print the last limit snapshots along the current branch (all by default), oldest first.
+        // With a cursor, the page before it instead: the last limit snapshots above version cursor.
+        // Only the active version can be an unsnapshotted node (new versions are always branched
+        // off a snapshot) and pruned versions are stepped over through kept_parent, so this costs
+        // O(limit) rather than O(depth). Sets next (if given) to the
+        // cursor of the page before this one, or NO_VERSION when there is none. Returns the count
+        // printed. Lock-free.
+        int history(OutputSink &out, size_t limit = SIZE_MAX, uint32_t cursor = NO_VERSION, uint32_t* next = nullptr) const {
+            EpochGuard pinned(epochs);
+            const FileHead* h = head.load(std::memory_order_seq_cst);
+            if(cursor != NO_VERSION && cursor >= (uint32_t)h->versions) throw std::out_of_range("Invalid version id");
+            std::vector<std::pair<uint32_t, VersionView>> path;
+            uint32_t curr = cursor == NO_VERSION ? h->active_id : view(cursor, *h).kept_parent;
+            while(curr != NO_VERSION && path.size() < limit){
+                VersionView v = view(curr, *h);
+                uint32_t parent = v.kept_parent;
+                if(v.snapshot_ts != 0) path.emplace_back(curr, std::move(v));
+                curr = parent;
+            }
+            if(next != nullptr){
+                // Another page only if a snapshot is left above the oldest one printed
+                *next = NO_VERSION;
+                while(!path.empty() && curr != NO_VERSION && *next == NO_VERSION){
+                    VersionView v = view(curr, *h);
+                    if(v.snapshot_ts != 0) *next = path.back().first;
+                    curr = v.kept_parent;
+                }
+            }
+            TimeFormatter format;
+            for(auto it = path.rbegin(); it != path.rend(); ++it){
+                const VersionView &node = it->second;
+                out << "Version " << it->first << '\n'
+                    << " | Created: " << format(node.created_ts);
+                out << " | Snapshot: " << format(node.snapshot_ts)
+                    << " | Message: " << node.message << '\n';
+            }
+            return path.size();
+        }
+
+        // Lowest common ancestor of two versions (a version is its own ancestor), in O(log depth). Lock-free.
+        int common_ancestor(int a, int b) const {
+            EpochGuard pinned(epochs);
+            const FileHead* h = head.load(std::memory_order_seq_cst);
+            if(a < 0 || a >= h->versions || b < 0 || b >= h->versions) {
+                throw std::out_of_range("Invalid version id");
+            }
+            uint32_t x = a, y = b;
+            uint32_t dx = links(x, *h).depth, dy = links(y, *h).depth;
+            if(dx > dy) x = ancestor_at(x, dy, *h);
+            else y = ancestor_at(y, dx, *h);
+            // At equal depth the jump pointers of x and y also have equal depths
+            while(x != y){
+                Links vx = links(x, *h), vy = links(y, *h);
+                if(vx.jump != vy.jump){ x = vx.jump; y = vy.jump; }
+                else{ x = vx.parent; y = vy.parent; }
+            }
+            return x;
+        }
+
+        // Content of any version. Unlike read(), needs the file's lock: a version other than
+        // the active one may be an unsnapshotted leaf that a later change edits again.
+        std::string read_version(int id) const {
+            if(id < 0 || id >= total_ver()) {
+                throw std::out_of_range("Invalid version id");
+            }
+            check_live(id);
+            return materialize(id);
+        }
+
+        // Length of a prefix versions a and b are known to share from delta storage alone: when
+        // one is at most KEYFRAME_INTERVAL deltas below the other, each delta on the way reuses
+        // the first base_len bytes of its parent. 0 when nothing is known. Needs the file's lock.
+        size_t shared_prefix(int a, int b) const {
+            for(int pass = 0; pass < 2; ++pass, std::swap(a, b)){
+                size_t shared = SIZE_MAX;
+                VersionView v = view(b);
+                for(uint32_t id = b, steps = 0; steps < KEYFRAME_INTERVAL; ++steps){
+                    if(id == (uint32_t)a) return shared == SIZE_MAX ? v.length : shared;
+                    if(v.base_len == 0) break;
+                    shared = std::min(shared, v.base_len);
+                    id = v.parent;
+                    v = view(id);
+                }
+            }
+            return 0;
+        }
+
+        // Name version id (the active version if -1) as a branch or a tag. Creating a branch does
+        // not check it out.
+        void add_ref(std::string_view name, RefKind kind, int id = -1){
+            if(refs.find(name) != RefTable::npos) {
+                throw std::runtime_error("Ref already exists: " + std::string(name));
+            }
+            if(id == -1) id = active_id;
+            else if(id < 0 || id >= total_ver()) {
+                throw std::out_of_range("Invalid version id");
+            }
+            check_live(id);
+            refs.add(name, kind, id);
+        }
+
+        // Make a ref's version active. A checked-out branch then follows the active version
+        // (new versions and ROLLBACK move it, as a commit or reset moves a Git branch); checking
+        // out a tag leaves no branch checked out. O(1) apart from publishing.
+        const Ref &checkout(std::string_view name){
+            uint32_t i = refs.find(name);
+            if(i == RefTable::npos) {
+                throw std::runtime_error("Ref not found: " + std::string(name));
+            }
+            current_ref = refs[i].kind == RefKind::BRANCH ? i : RefTable::npos;
+            rollback(refs[i].target);
+            return refs[i];
+        }
+
+        // Make a version active with no branch checked out
+        void checkout(int id){
+            if(id < 0 || id >= total_ver()) {
+                throw std::out_of_range("Invalid version id");
+            }
+            check_live(id);
+            current_ref = RefTable::npos;
+            rollback(id);
+        }
+
+        // Drop the versions nothing needs any more; returns how many were dropped. Kept are the
+        // active version, every branch and tag, and above each of them the nearest keep snapshots
+        // (SIZE_MAX: all ancestors). Abandoned unsnapshotted versions and unnamed side branches go.
+        // A dropped version keeps its id and its place in the tree, so ids, depths and jump
+        // pointers stay valid, but loses its content and message; kept deltas against it are
+        // rewritten as keyframes first. Unlike other changes this also rewrites snapshots, so it
+        // must not run alongside lock-free readers (the command layer locks the whole repository).
+        size_t prune(size_t keep = SIZE_MAX){
+            ensure_loaded();
+            std::vector<char> live(version_map.size(), 0);
+            auto mark = [&](uint32_t tip){
+                size_t snaps = 0;
+                for(uint32_t id = tip; id != NO_VERSION; id = version_map[id].parent){
+                    const TreeNode &n = version_map[id];
+                    bool snap = !n.pruned && n.snapshot_ts != 0;
+                    if(id != tip && snap && snaps == keep) break;
+                    if(keep == SIZE_MAX && live[id]) break; // Its ancestors are marked already
+                    if(!n.pruned) live[id] = 1;
+                    snaps += snap;
+                }
+            };
+            mark(active_id);
+            for(const Ref &r : refs) mark(r.target);
+
+            // Rewrite first, while every delta chain is still intact
+            size_t dropped = 0;
+            for(uint32_t id = 0; id < version_map.size(); ++id){
+                TreeNode &n = version_map[id];
+                if(search_index && live[id] && n.parent != NO_VERSION && !live[n.parent]) search_index->forget(id);
+                if(live[id] && n.base_len != 0 && !live[n.parent]){
+                    std::string full = materialize(id);
+                    unspill(n);
+                    n.data = blob_store.intern(full);
+                    if(id == active_id) appending.reset();
+                    n.compressed = false;
+                    n.base_len = 0;
+                    n.delta_depth = 0;
+                    if(search_index) search_index->forget(id);
+                }
+            }
+            for(uint32_t id = 0; id < version_map.size(); ++id){
+                TreeNode &n = version_map[id];
+                if(live[id] || n.pruned) continue;
+                n.pruned = true;
+                n.compressed = false;
+                unspill(n);
+                n.data = BlobRef();
+                n.base_len = n.length = 0;
+                n.delta_depth = 0;
+                n.snapshot_ts = 0;
+                std::string().swap(n.message);
+                ++dropped;
+            }
+            // Parents have lower ids, so each one's link is final before its children's
+            for(uint32_t id = 0; id < version_map.size(); ++id){
+                TreeNode &n = version_map[id];
+                if(n.parent == NO_VERSION) continue;
+                const TreeNode &p = version_map[n.parent];
+                n.kept_parent = p.pruned ? p.kept_parent : n.parent;
+            }
+            publish();
+            return dropped;
+        }
+
+        // Compress the bytes of cold versions: snapshots off the active path (neither the active
+        // version nor one of its ancestors) that have not been used since cutoff. Looks at up
+        // to budget versions from id from, counting them off budget, and returns the id to go
+        // on from (total_ver() when done); compressed adds the versions compressed. Bytes that
+        // shrink by less than an eighth are left alone. A compressed version is never expanded
+        // again: reads decompress it through cold_cache. With a segment_store the bytes (compressed
+        // or not) are then moved there, out of memory; spilled adds the versions moved. Like
+        // prune() this rewrites snapshots, so it must not run alongside lock-free readers. Files
+        // still served from a repository image (paged in from its mapping already) are skipped.
+        // With whole_history (memory pressure) the active version's ancestors qualify too, all
+        // but its delta chain: the versions its current content is rebuilt from.
+        uint32_t compress_cold(Timestamp cutoff, uint32_t from, size_t &budget, size_t &compressed, size_t &spilled,
+                               bool whole_history = false){
+            if(image != nullptr) return total_ver();
+            const FileHead &h = *head.load();
+            uint32_t active_depth = version_map[active_id].depth;
+            uint32_t kept_depth = 0; // Shallowest ancestor kept
+            if(whole_history){
+                uint32_t k = active_id;
+                while(version_map[k].base_len != 0) k = version_map[k].parent;
+                kept_depth = version_map[k].depth;
+            }
+            uint32_t id = from;
+            for(; id < version_map.size() && budget > 0; ++id, --budget){
+                TreeNode &n = version_map[id];
+                if(n.pruned || n.spilled != 0 || (n.compressed && !segment_store) || n.snapshot_ts == 0 || n.last_used > cutoff ||
+                   n.data.size() < 64) continue;
+                if(n.depth <= active_depth && n.depth >= kept_depth && ancestor_at(active_id, n.depth, h) == id) continue;
+                if(compress(n)) ++compressed;
+                if(segment_store){
+                    n.spilled = segment_store->append(n.data.view());
+                    n.data = BlobRef();
+                    ++spilled;
+                }
+            }
+            return id;
+        }
+
+        // Add this file's versions to s. O(versions); needs the file's lock.
+        void add_stats(FileStats &s) const {
+            uint32_t n = total_ver();
+            s.versions += n;
+            s.refs += refs.size();
+            for(uint32_t id = 0; id < n; ++id){
+                VersionView v = view(id);
+                s.snapshots += v.snapshot_ts != 0;
+                s.pruned += v.pruned;
+                s.compressed += v.compressed;
+                s.spilled += v.spilled != 0;
+                s.logical_bytes += v.length;
+                s.own_bytes += v.data.size();
+            }
+        }
+
+        // Versions whose content contains pattern, in id order. A version whose content begins
+        // with the first p bytes of its parent's (p = base_len for a delta, or the prefix recorded
+        // in search_index) contains pattern if its parent has an occurrence ending within them,
+        // or one straddles the end of that prefix, or the bytes past it hold one; only the last
+        // needs a scan, and only when search_index cannot rule it out. Snapshots missing from the
+        // index (all of them on the first search) are indexed first; unsnapshotted versions,
+        // which may still change, are always scanned. Needs the file's lock.
+        std::vector<uint32_t> search(std::string_view pattern){
+            uint32_t n = total_ver();
+            if(!search_index) search_index = std::make_unique<TrigramIndex>();
+            for(uint32_t id = 0; id < n; ++id){
+                VersionView v = view(id);
+                if(!v.pruned && v.snapshot_ts != 0 && !search_index->covers(id)) index_version(id);
+            }
+            std::vector<char> maybe = search_index->candidates(pattern, n);
+            size_t m = pattern.size();
+            std::vector<size_t> first_end(n, SIZE_MAX); // End of the first occurrence in each version's content
+            std::vector<uint32_t> found;
+            for(uint32_t id = 0; id < n; ++id){
+                VersionView v = view(id);
+                if(v.pruned) continue;
+                size_t end = SIZE_MAX, prefix = search_index->shared_prefix(id, v.base_len);
+                if(prefix != 0 && first_end[v.parent] <= prefix) end = first_end[v.parent];
+                else{
+                    if(prefix != 0 && m > 1){
+                        size_t lo = prefix >= m - 1 ? prefix - (m - 1) : 0;
+                        size_t at = find_in(content(id, nullptr, lo, prefix - lo + m - 1), pattern);
+                        if(at != std::string_view::npos) end = lo + at + m;
+                    }
+                    if(end == SIZE_MAX && maybe[id]){
+                        size_t at = find_in(content(id, nullptr, prefix, SIZE_MAX), pattern);
+                        if(at != std::string_view::npos) end = prefix + at + m;
+                    }
+                }
+                first_end[id] = end;
+                if(end != SIZE_MAX) found.push_back(id);
+            }
+            return found;
+        }
+
+        // Branches and tags in creation order, and the checked-out branch (RefTable::npos if none)
+        const RefTable &ref_table() const {return refs;}
+        uint32_t checked_out() const {return current_ref;}
+
+        // Append this file's records to a repository being saved. blob_ids maps blobs already
+        // written (by the address of their bytes) to their blob index, so shared blobs are written once.
+        void save(RepoWriter &w, std::unordered_map<const char*, uint64_t> &blob_ids) const {
+            RepoFileRecord fr;
+            std::memset(&fr, 0, sizeof(fr));
+            fr.name_offset = w.add_string(file_name);
+            fr.name_length = file_name.size();
+            fr.node_count = total_ver();
+            fr.first_node = w.node_count();
+            fr.seq = seq;
+            fr.last_modification = last_modification;
+            fr.active_version = active_id;
+            fr.ref_count = refs.size();
+            fr.first_ref = w.ref_count();
+            fr.current_ref = current_ref == RefTable::npos ? REPO_NO_REF : current_ref;
+            for(const Ref &r : refs){
+                RepoRefRecord rr;
+                std::memset(&rr, 0, sizeof(rr));
+                rr.name_offset = w.add_string(r.name);
+                rr.name_length = r.name.size();
+                rr.target = r.target;
+                rr.kind = static_cast<uint32_t>(r.kind);
+                w.add_ref(rr);
+            }
+            for(uint32_t id = 0; id < fr.node_count; ++id){
+                VersionView v = view(id);
+                RepoNodeRecord nr;
+                std::memset(&nr, 0, sizeof(nr));
+                nr.parent = v.parent;
+                nr.delta_depth = image != nullptr ? image->node(*record, id).delta_depth : version_map[id].delta_depth;
+                nr.depth = v.depth;
+                nr.jump = v.jump;
+                nr.kept_parent = v.kept_parent;
+                nr.flags = (v.pruned ? REPO_NODE_PRUNED : 0) | (v.compressed ? REPO_NODE_COMPRESSED : 0);
+                nr.base_len = v.base_len;
+                nr.length = v.length;
+                if(v.spilled != 0) nr.blob = w.add_blob(segment_store->read(v.spilled)); // Not shared with other versions
+                else{
+                    // Non-empty blobs never share a start address; all empty blobs share key nullptr
+                    const char* key = v.data.empty() ? nullptr : v.data.data();
+                    auto it = blob_ids.find(key);
+                    if(it == blob_ids.end()) it = blob_ids.emplace(key, w.add_blob(v.data)).first;
+                    nr.blob = it->second;
+                }
+                nr.created_ts = v.created_ts;
+                nr.snapshot_ts = v.snapshot_ts;
+                nr.message_offset = w.add_string(v.message);
+                nr.message_length = v.message.size();
+                w.add_node(nr);
+            }
+            w.add_file(fr);
+        }
+};
+
+#endif // VERSION_FILE_H
@@ -0,0 +1,326 @@
+//
+// WriteAheadLog: append-only log of mutating commands with group commit.
+//
+// Layout (little-endian): a file header
+//     char magic[8] "VCSWALOG" | uint32 format_version | uint32 reserved (0)
+// followed by records
+//     uint32 payload_length | uint32 crc32 | uint64 seq | int64 timestamp | payload
+// The CRC covers seq, timestamp and payload. The payload is the command line;
+// the timestamp is the command's clock (nanoseconds since the epoch, clock.h).
+// Logs of older builds (no header, timestamps in seconds) are rejected by
+// replay() rather than misread.
+//
+// Group commit: append() only buffers the record. The buffer is written and
+// fsync'ed once sync_records records are pending, or by a background thread at
+// most sync_ms milliseconds after the first pending record. One fsync therefore
+// covers a whole group of commands. A crash loses at most that last unsynced
+// group. sync() forces the buffer out immediately.
+//
+// Recovery: replay() reads records in order and stops at the first torn or
+// corrupt record, truncating the log there. That record was never acknowledged
+// as durable.
+//
+
+#ifndef WAL_H
+#define WAL_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const char WAL_MAGIC[8] = {'V', 'C', 'S', 'W', 'A', 'L', 'O', 'G'};
+static const uint32_t WAL_FORMAT_VERSION = 2; // 1: no file header, timestamps in seconds
+
+// CRC-32 (IEEE 802.3, reflected), table driven
+struct Crc32Table
+{
+    uint32_t t[256];
+    Crc32Table(){
+        for(uint32_t i = 0; i < 256; ++i){
+            uint32_t c = i;
+            for(int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+    }
+};
+
+inline uint32_t crc32(const void* data, size_t len, uint32_t crc = 0){
+    static const Crc32Table table;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for(size_t i = 0; i < len; ++i) crc = table.t[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+class WriteAheadLog
+{
+    private:
+        static constexpr size_t HEADER_SIZE = 24;      // Of a record
+        static constexpr size_t FILE_HEADER_SIZE = 16;
+
+        int fd;
+        std::string path;
+        size_t sync_records;
+        std::chrono::milliseconds sync_interval;
+
+        std::mutex io_mutex; // Serializes write+fsync so groups reach the disk in order
+        std::mutex m;        // Protects everything below
+        std::condition_variable cv;
+        std::string pending; // Encoded records not yet written
+        size_t pending_records = 0;
+        uint64_t next_seq;
+        uint64_t log_bytes;  // Size of the log file including pending records
+        bool stopping = false;
+        bool failed = false; // A group could not be written; the log is no longer durable
+        std::thread flusher;
+
+        static int open_log(const std::string &p){
+#ifdef _WIN32
+            int f = _open(p.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+            int f = ::open(p.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
+            if(f < 0) throw std::runtime_error("Cannot open write-ahead log: " + p);
+            return f;
+        }
+
+        static bool write_all(int f, const char* p, size_t n){
+            while(n > 0){
+#ifdef _WIN32
+                long w = _write(f, p, (unsigned)n);
+#else
+                long w = ::write(f, p, n);
+#endif
+                if(w < 0){ if(errno == EINTR) continue; return false; }
+                p += w; n -= w;
+            }
+            return true;
+        }
+
+        static bool sync_fd(int f){
+#ifdef _WIN32
+            return _commit(f) == 0;
+#else
+            return fsync(f) == 0;
+#endif
+        }
+
+        // Write and fsync everything pending (one group)
+        void flush_group(){
+            std::lock_guard<std::mutex> io(io_mutex);
+            std::string group;
+            {
+                std::lock_guard<std::mutex> lk(m);
+                group.swap(pending);
+                pending_records = 0;
+            }
+            if(!group.empty() && (!write_all(fd, group.data(), group.size()) || !sync_fd(fd))){
+                std::lock_guard<std::mutex> lk(m);
+                failed = true;
+            }
+            std::lock_guard<std::mutex> lk(m);
+            if(failed) throw std::runtime_error("Cannot write write-ahead log: " + path);
+        }
+
+        void flusher_loop(){
+            std::unique_lock<std::mutex> lk(m);
+            while(!stopping){
+                cv.wait(lk, [&]{ return stopping || pending_records > 0; });
+                if(stopping) break;
+                // Give more records a chance to join this group
+                cv.wait_for(lk, sync_interval, [&]{ return stopping; });
+                lk.unlock();
+                try { flush_group(); } catch(const std::exception &) { /* reported by the next append() */ }
+                lk.lock();
+            }
+        }
+
+        static void put64(char* p, uint64_t v){ std::memcpy(p, &v, 8); }
+        static void put32(char* p, uint32_t v){ std::memcpy(p, &v, 4); }
+
+        // Start an empty log file with the file header
+        static bool write_file_header(int f){
+            char hdr[FILE_HEADER_SIZE] = {};
+            std::memcpy(hdr, WAL_MAGIC, 8);
+            put32(hdr + 8, WAL_FORMAT_VERSION);
+            return write_all(f, hdr, FILE_HEADER_SIZE) && sync_fd(f);
+        }
+
+    public:
+        // Append the encoded record (header and payload) to out
+        static void encode(std::string &out, uint64_t seq, int64_t ts, std::string_view payload){
+            char hdr[HEADER_SIZE];
+            put32(hdr, (uint32_t)payload.size());
+            put64(hdr + 8, seq);
+            put64(hdr + 16, (uint64_t)ts);
+            uint32_t crc = crc32(hdr + 8, 16);
+            crc = crc32(payload.data(), payload.size(), crc);
+            put32(hdr + 4, crc);
+            out.append(hdr, HEADER_SIZE);
+            out.append(payload.data(), payload.size());
+        }
+
+        // Decode the record at the start of p[0, n). Returns its encoded size, or 0 if the bytes do
+        // not hold a whole record whose CRC matches (payload points into p)
+        static size_t decode(const char* p, size_t n, uint64_t &seq, int64_t &ts, std::string_view &payload){
+            if(n < HEADER_SIZE) return 0;
+            uint32_t len, crc;
+            std::memcpy(&len, p, 4);
+            std::memcpy(&crc, p + 4, 4);
+            if(len > n - HEADER_SIZE) return 0;
+            uint32_t actual = crc32(p + 8, 16);
+            actual = crc32(p + HEADER_SIZE, len, actual);
+            if(actual != crc) return 0;
+            uint64_t t;
+            std::memcpy(&seq, p + 8, 8);
+            std::memcpy(&t, p + 16, 8);
+            ts = (int64_t)t;
+            payload = std::string_view(p + HEADER_SIZE, len);
+            return HEADER_SIZE + len;
+        }
+
+        // Open (or create) the log at p for appending; records get sequence numbers from first_seq
+        WriteAheadLog(const std::string &p, uint64_t first_seq, size_t group_records = 64, unsigned group_ms = 10)
+            : fd(open_log(p)), path(p), sync_records(group_records ? group_records : 1), sync_interval(group_ms),
+              next_seq(first_seq) {
+            struct stat st;
+            log_bytes = (fstat(fd, &st) == 0) ? st.st_size : 0;
+            if(log_bytes == 0){
+                if(!write_file_header(fd)){
+#ifdef _WIN32
+                    _close(fd);
+#else
+                    ::close(fd);
+#endif
+                    throw std::runtime_error("Cannot write write-ahead log: " + p);
+                }
+                log_bytes = FILE_HEADER_SIZE;
+            }
+            flusher = std::thread(&WriteAheadLog::flusher_loop, this);
+        }
+        WriteAheadLog(const WriteAheadLog &) = delete;
+        WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+        ~WriteAheadLog(){
+            {
+                std::lock_guard<std::mutex> lk(m);
+                stopping = true;
+            }
+            cv.notify_all();
+            flusher.join();
+            try { flush_group(); } catch(const std::exception &) {}
+#ifdef _WIN32
+            _close(fd);
+#else
+            ::close(fd);
+#endif
+        }
+
+        // Sequence number of the last record appended (0 if none yet)
+        uint64_t last_seq(){ std::lock_guard<std::mutex> lk(m); return next_seq - 1; }
+
+        // Bytes in the log, including records not yet synced
+        uint64_t size(){ std::lock_guard<std::mutex> lk(m); return log_bytes; }
+
+        // Buffer one record; returns its sequence number
+        uint64_t append(std::string_view payload, int64_t ts){
+            bool full;
+            uint64_t seq;
+            {
+                std::lock_guard<std::mutex> lk(m);
+                if(failed) throw std::runtime_error("Cannot write write-ahead log: " + path);
+                seq = next_seq++;
+                encode(pending, seq, ts, payload);
+                log_bytes += HEADER_SIZE + payload.size();
+                full = ++pending_records >= sync_records;
+            }
+            if(full) flush_group();
+            else cv.notify_one();
+            return seq;
+        }
+
+        // Make every appended record durable now
+        void sync(){ flush_group(); }
+
+        // Drop all records (after they have been folded into a checkpoint)
+        void reset(){
+            std::lock_guard<std::mutex> io(io_mutex);
+            std::lock_guard<std::mutex> lk(m);
+            pending.clear();
+            pending_records = 0;
+#ifdef _WIN32
+            bool ok = _chsize(fd, 0) == 0;
+#else
+            bool ok = ftruncate(fd, 0) == 0;
+#endif
+            if(!ok || !write_file_header(fd)) throw std::runtime_error("Cannot truncate write-ahead log: " + path);
+            log_bytes = FILE_HEADER_SIZE;
+        }
+
+        // Replay the records of the log at p with seq > after_seq through fn(seq, ts, payload).
+        // A torn or corrupt tail is cut off; a log of another format version is refused.
+        // Returns the highest sequence number seen (or after_seq).
+        template <typename Fn>
+        static uint64_t replay(const std::string &p, uint64_t after_seq, Fn fn){
+            FILE* f = std::fopen(p.c_str(), "rb");
+            if(f == nullptr) return after_seq;
+            std::string log;
+            char chunk[1 << 16];
+            size_t n;
+            while((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0) log.append(chunk, n);
+            std::fclose(f);
+
+            uint64_t last = after_seq;
+            size_t pos = 0;
+            if(log.size() < FILE_HEADER_SIZE && std::memcmp(log.data(), WAL_MAGIC, std::min(log.size(), sizeof(WAL_MAGIC))) == 0){
+                // Empty, or the header of a new log torn by a crash: nothing was logged yet
+            } else {
+                if(log.size() < FILE_HEADER_SIZE || std::memcmp(log.data(), WAL_MAGIC, 8) != 0){
+                    throw std::runtime_error("Write-ahead log written by an older version (no format header): " + p);
+                }
+                uint32_t version;
+                std::memcpy(&version, log.data() + 8, 4);
+                if(version != WAL_FORMAT_VERSION){
+                    throw std::runtime_error("Unsupported write-ahead log format version " + std::to_string(version) + ": " + p);
+                }
+                pos = FILE_HEADER_SIZE;
+            }
+            while(true){
+                uint64_t seq;
+                int64_t ts;
+                std::string_view payload;
+                size_t used = decode(log.data() + pos, log.size() - pos, seq, ts, payload);
+                if(used == 0) break;
+                if(seq > last){
+                    fn(seq, ts, payload);
+                    last = seq;
+                }
+                pos += used;
+            }
+            if(pos != log.size()){
+#ifdef _WIN32
+                int tf = _open(p.c_str(), _O_WRONLY | _O_BINARY);
+                if(tf >= 0){ _chsize(tf, (long)pos); _close(tf); }
+#else
+                if(truncate(p.c_str(), pos) != 0) throw std::runtime_error("Cannot truncate write-ahead log: " + p);
+#endif
+            }
+            return last;
+        }
+};
+
+#endif // WAL_H